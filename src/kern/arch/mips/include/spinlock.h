@@ -46,6 +46,9 @@ SPINLOCK_INLINE
 spinlock_data_t spinlock_data_get(volatile spinlock_data_t *sd);
 SPINLOCK_INLINE
 spinlock_data_t spinlock_data_testandset(volatile spinlock_data_t *sd);
+SPINLOCK_INLINE
+bool spinlock_data_cas(volatile spinlock_data_t *sd,
+		       spinlock_data_t oldval, spinlock_data_t newval);
 
 ////////////////////////////////////////////////////////////
 
@@ -118,5 +121,40 @@ spinlock_data_testandset(volatile spinlock_data_t *sd)
 	return x;
 }
 
+/*
+ * Compare-and-swap a spinlock_data_t: if it contains OLDVAL, replace
+ * it with NEWVAL and return true; otherwise return false. Also uses
+ * LL/SC; a failed SC counts as a mismatch, so callers must be
+ * prepared to retry even if the value looked right.
+ */
+SPINLOCK_INLINE
+bool
+spinlock_data_cas(volatile spinlock_data_t *sd,
+		  spinlock_data_t oldval, spinlock_data_t newval)
+{
+	spinlock_data_t x;
+	spinlock_data_t y;
+
+	/*
+	 * Load the existing value into X. If it matches, try to store
+	 * Y (NEWVAL); afterwards Y is 1 if the store succeeded and 0 if
+	 * it failed. If it doesn't match, skip the SC; X then tells us
+	 * we failed regardless of Y.
+	 */
+
+	y = newval;
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		"ll %0, 0(%2);"		/*   x = *sd */
+		"bne %0, %3, 1f;"	/*   if (x != oldval) goto 1 */
+		"sc %1, 0(%2);"		/*   *sd = y; y = success? */
+		"1:"
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "+r" (y) : "r" (sd), "r" (oldval));
+	return x == oldval && y != 0;
+}
+
 
 #endif /* _MIPS_SPINLOCK_H_ */
@@ -67,6 +67,12 @@
  */
 #define PADDR_TO_KVADDR(paddr) ((paddr)+MIPS_KSEG0)
 
+/*
+ * And the reverse, for kernel addresses within kseg0 (such as those
+ * handed out by alloc_kpages).
+ */
+#define KVADDR_TO_PADDR(vaddr) ((vaddr)-MIPS_KSEG0)
+
 /*
  * The top of user space. (Actually, the address immediately above the
  * last valid user address.)
@@ -117,13 +123,17 @@ paddr_t ram_getfirstfree(void);
  */
 
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	vaddr_t ts_va;			/* first page to invalidate */
+	unsigned ts_npages;		/* number of pages */
+	uint32_t ts_pid;		/* their address space's EntryHi PID */
 };
 
 #define TLBSHOOTDOWN_MAX 16
 
+/*
+ * Per-CPU page directory for the UTLB refill handler (see cpu.c).
+ */
+extern vaddr_t cpupagetables[];
+
 
 #endif /* _MIPS_VM_H_ */
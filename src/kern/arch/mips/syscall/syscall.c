@@ -109,6 +109,41 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_fork:
+		err = sys_fork(tf, &retval);
+		break;
+
+	    case SYS_sbrk:
+		err = sys_sbrk((intptr_t)tf->tf_a0, &retval);
+		break;
+
+	    case SYS_mmap:
+		err = sys_mmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+			       tf->tf_a2, tf->tf_a3, &retval);
+		break;
+
+	    case SYS_munmap:
+		err = sys_munmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1);
+		break;
+
+	    case SYS_madvise:
+		err = sys_madvise((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+				  tf->tf_a2);
+		break;
+
+	    case SYS_mincore:
+		err = sys_mincore((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+				  (userptr_t)tf->tf_a2);
+		break;
+
+	    case SYS_mlock:
+		err = sys_mlock((userptr_t)tf->tf_a0, (size_t)tf->tf_a1);
+		break;
+
+	    case SYS_munlock:
+		err = sys_munlock((userptr_t)tf->tf_a0, (size_t)tf->tf_a1);
+		break;
+
 	    /* Add stuff here */
 
 	    default:
@@ -149,13 +184,21 @@ syscall(struct trapframe *tf)
 /*
  * Enter user mode for a newly forked process.
  *
- * This function is provided as a reminder. You need to write
- * both it and the code that calls it.
- *
- * Thus, you can trash it and do things another way if you prefer.
+ * TF is a heap copy of the parent's trapframe at the fork syscall;
+ * it is copied onto our own stack and freed. The child returns 0
+ * from fork. Does not return.
  */
 void
 enter_forked_process(struct trapframe *tf)
 {
-	(void)tf;
+	struct trapframe mytf;
+
+	mytf = *tf;
+	kfree(tf);
+
+	mytf.tf_v0 = 0;
+	mytf.tf_a3 = 0;      /* signal no error */
+	mytf.tf_epc += 4;
+
+	mips_usermode(&mytf);
 }
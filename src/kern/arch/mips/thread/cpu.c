@@ -67,6 +67,13 @@
 vaddr_t cpustacks[MAXCPUS];
 vaddr_t cputhreads[MAXCPUS];
 
+/*
+ * Page directory of the address space active on each CPU, for the
+ * fast-path TLB refill handler in exception-mips1.S; 0 sends every
+ * refill to vm_fault. Maintained by vm/vmtlb.c.
+ */
+vaddr_t cpupagetables[MAXCPUS];
+
 /*
  * Do machine-dependent initialization of the cpu structure or things
  * associated with a new cpu. Note that we're not running on the new
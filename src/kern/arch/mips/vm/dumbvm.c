@@ -118,6 +118,17 @@ alloc_kpages(unsigned npages)
 	return PADDR_TO_KVADDR(pa);
 }
 
+/*
+ * Release pages obtained from getppages. There is nothing to give
+ * them back to, so they leak.
+ */
+static
+void
+freeppages(paddr_t paddr)
+{
+	(void)paddr;
+}
+
 void
 free_kpages(vaddr_t addr)
 {
@@ -133,6 +144,12 @@ vm_tlbshootdown(const struct tlbshootdown *ts)
 	panic("dumbvm tried to do tlb shootdown?!\n");
 }
 
+void
+vm_tlbshootdown_all(void)
+{
+	panic("dumbvm tried to do tlb shootdown?!\n");
+}
+
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
@@ -257,6 +274,16 @@ void
 as_destroy(struct addrspace *as)
 {
 	dumbvm_can_sleep();
+
+	if (as->as_pbase1 != 0) {
+		freeppages(as->as_pbase1);
+	}
+	if (as->as_pbase2 != 0) {
+		freeppages(as->as_pbase2);
+	}
+	if (as->as_stackpbase != 0) {
+		freeppages(as->as_stackpbase);
+	}
 	kfree(as);
 }
 
@@ -383,6 +410,73 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	/* dumbvm has no heap. */
+	(void)as;
+	(void)amount;
+	(void)oldbreak;
+	return ENOSYS;
+}
+
+int
+as_mmap(struct addrspace *as, vaddr_t addr, size_t len, int prot, int flags,
+	struct vnode *v, off_t offset, vaddr_t *ret)
+{
+	/* Nor any room for mappings. */
+	(void)as;
+	(void)addr;
+	(void)len;
+	(void)prot;
+	(void)flags;
+	(void)v;
+	(void)offset;
+	(void)ret;
+	return ENOSYS;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	(void)as;
+	(void)addr;
+	(void)len;
+	return ENOSYS;
+}
+
+int
+as_madvise(struct addrspace *as, vaddr_t addr, size_t len, int advice)
+{
+	/* Everything is resident anyway. */
+	(void)as;
+	(void)addr;
+	(void)len;
+	(void)advice;
+	return 0;
+}
+
+int
+as_mincore(struct addrspace *as, vaddr_t addr, unsigned npages,
+	   unsigned char *vec)
+{
+	(void)as;
+	(void)addr;
+	(void)npages;
+	(void)vec;
+	return ENOSYS;
+}
+
+int
+as_mlock(struct addrspace *as, vaddr_t addr, size_t len, bool lock)
+{
+	(void)as;
+	(void)addr;
+	(void)len;
+	(void)lock;
+	return 0;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
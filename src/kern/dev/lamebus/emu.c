@@ -54,6 +54,11 @@
 #include <vfs.h>
 #include <emufs.h>
 #include "autoconf.h"
+#include "opt-paging.h"
+
+#if OPT_PAGING
+#include <pagecache.h>
+#endif
 
 /* Register offsets */
 #define REG_HANDLE    0
@@ -499,6 +504,11 @@ emufs_reclaim(struct vnode *v)
 	 */
 	spinlock_release(&ev->ev_v.vn_countlock);
 
+#if OPT_PAGING
+	/* The page cache doesn't hold references; make it forget us. */
+	pagecache_invalidate(v);
+#endif
+
 	/* emu_close retries on I/O error */
 	result = emu_close(ev->ev_emu, ev->ev_handle);
 	if (result) {
@@ -599,10 +609,14 @@ emufs_write(struct vnode *v, struct uio *uio)
 	struct emufs_vnode *ev = v->vn_data;
 	uint32_t amt;
 	size_t oldresid;
+	off_t start;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
+	start = uio->uio_offset;
+	result = 0;
+
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
@@ -613,7 +627,7 @@ emufs_write(struct vnode *v, struct uio *uio)
 
 		result = emu_write(ev->ev_emu, ev->ev_handle, amt, uio);
 		if (result) {
-			return result;
+			break;
 		}
 
 		if (uio->uio_resid == oldresid) {
@@ -622,7 +636,14 @@ emufs_write(struct vnode *v, struct uio *uio)
 		}
 	}
 
-	return 0;
+#if OPT_PAGING
+	/* Cached pages of what we wrote are now stale. */
+	pagecache_invalidate_range(v, start, uio->uio_offset);
+#else
+	(void)start;
+#endif
+
+	return result;
 }
 
 /*
@@ -725,7 +746,13 @@ int
 emufs_truncate(struct vnode *v, off_t len)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	return emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	int result;
+
+	result = emu_trunc(ev->ev_emu, ev->ev_handle, len);
+#if OPT_PAGING
+	pagecache_invalidate(v);
+#endif
+	return result;
 }
 
 /*
@@ -845,13 +872,15 @@ emufs_namefile(struct vnode *v, struct uio *uio)
 
 /*
  * VOP_MMAP
+ *
+ * Files can be mapped; the VM system pages them in with VOP_READ.
  */
 static
 int
 emufs_mmap(struct vnode *v)
 {
 	(void)v;
-	return ENOSYS;
+	return 0;
 }
 
 //////////////////////////////
@@ -41,6 +41,12 @@
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
+#include "opt-paging.h"
+
+#if OPT_PAGING
+#include <vm.h>
+#include <pagecache.h>
+#endif
 
 ////////////////////////////////////////////////////////////
 // Vnode operations.
@@ -90,8 +96,53 @@ sfs_eachopendir(struct vnode *v, int openflags)
 	return 0;
 }
 
+#if OPT_PAGING
+/*
+ * Read into user memory through the page cache, a page at a time, so
+ * that file data read and file data mapped with mmap are the same
+ * physical pages. Cache misses are filled with VOP_READ into a kernel
+ * buffer, which comes back to sfs_read and goes straight to sfs_io.
+ */
+static
+int
+sfs_cachedread(struct vnode *v, struct uio *uio)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	off_t size, pageoff;
+	size_t len, skip, n;
+	paddr_t pa;
+	int result;
+
+	vfs_biglock_acquire();
+	size = sv->sv_i.sfi_size;
+	vfs_biglock_release();
+
+	while (uio->uio_resid > 0 && uio->uio_offset < size) {
+		pageoff = uio->uio_offset - uio->uio_offset % PAGE_SIZE;
+		len = size - pageoff < PAGE_SIZE ? size - pageoff : PAGE_SIZE;
+		skip = uio->uio_offset - pageoff;
+		n = len - skip;
+		if (n > uio->uio_resid) {
+			n = uio->uio_resid;
+		}
+
+		result = pagecache_get(v, pageoff, 0, len, &pa);
+		if (result) {
+			return result;
+		}
+		result = uiomove((char *)PADDR_TO_KVADDR(pa) + skip, n, uio);
+		pagecache_put(pa);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+#endif
+
 /*
- * Called for read(). sfs_io() does the work.
+ * Called for read(). sfs_io() does the work, except that reads into
+ * user memory go through the page cache.
  */
 static
 int
@@ -102,6 +153,12 @@ sfs_read(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
+#if OPT_PAGING
+	if (uio->uio_segflg != UIO_SYSSPACE) {
+		return sfs_cachedread(v, uio);
+	}
+#endif
+
 	vfs_biglock_acquire();
 	result = sfs_io(sv, uio);
 	vfs_biglock_release();
@@ -117,12 +174,23 @@ int
 sfs_write(struct vnode *v, struct uio *uio)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	off_t start;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
 	vfs_biglock_acquire();
+	start = uio->uio_offset;
 	result = sfs_io(sv, uio);
+#if OPT_PAGING
+	/*
+	 * Cached pages of what we wrote are now stale. Drop them before
+	 * anyone else can read the new contents.
+	 */
+	pagecache_invalidate_range(v, start, uio->uio_offset);
+#else
+	(void)start;
+#endif
 	vfs_biglock_release();
 
 	return result;
@@ -232,14 +300,16 @@ sfs_fsync(struct vnode *v)
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). Regular files can always be mapped; the VM
+ * system reads the pages through the page cache, which sfs_read
+ * shares.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v)
 {
 	(void)v;
-	return ENOSYS;
+	return 0;
 }
 
 /*
@@ -250,8 +320,21 @@ int
 sfs_truncate(struct vnode *v, off_t len)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	off_t oldsize;
+	int result;
 
-	return sfs_itrunc(sv, len);
+	vfs_biglock_acquire();
+	oldsize = sv->sv_i.sfi_size;
+	result = sfs_itrunc(sv, len);
+#if OPT_PAGING
+	/* Growing the file doesn't change anything that could be cached. */
+	pagecache_invalidate_range(v, len, oldsize);
+#else
+	(void)oldsize;
+#endif
+	vfs_biglock_release();
+
+	return result;
 }
 
 /*
@@ -36,9 +36,50 @@
 
 
 #include <vm.h>
+#include <spinlock.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct pagetable;
+
+
+#if !OPT_DUMBVM
+/*
+ * A region is a page-aligned range of user addresses [rg_base, rg_top)
+ * that is valid to touch, with its permissions. Pages within a region
+ * are not allocated until first touched.
+ *
+ * A region may be backed by part of a file: the bytes at
+ * [rg_fileva, rg_fileva + rg_filesize) come from RG_VNODE starting at
+ * RG_OFFSET, and the rest of the region is zero. Such pages are read
+ * in when first touched; after that they are ordinary anonymous
+ * memory. (RG_FILEVA may lie below RG_BASE if the front of a mapping
+ * has been unmapped.)
+ *
+ * Regions made by mmap are marked RG_MMAP; only those can be
+ * unmapped. A mapping with PROT_NONE has none of RG_READ, RG_WRITE,
+ * or RG_EXEC, and every access to it faults.
+ *
+ * RG_ADVICE is the access pattern given with madvise (MADV_NORMAL,
+ * MADV_RANDOM, or MADV_SEQUENTIAL), for the whole region.
+ */
+struct region {
+	vaddr_t rg_base;
+	vaddr_t rg_top;
+	unsigned rg_flags;		/* RG_* */
+	unsigned rg_advice;		/* MADV_* access pattern */
+	struct vnode *rg_vnode;		/* backing file, or NULL */
+	off_t rg_offset;		/* file offset of rg_fileva */
+	vaddr_t rg_fileva;		/* start of file-backed part */
+	size_t rg_filesize;		/* length of file-backed part */
+	struct region *rg_next;		/* list sorted by rg_base */
+};
+
+#define RG_READ		0x1
+#define RG_WRITE	0x2
+#define RG_EXEC		0x4
+#define RG_MMAP		0x8		/* made by as_mmap */
+#endif
 
 
 /*
@@ -58,7 +99,14 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
-        /* Put stuff here for your VM system */
+        struct region *as_regions;	/* valid address ranges */
+        struct region *as_heap;		/* sbrk region (in as_regions) */
+        struct pagetable *as_pt;	/* virtual to physical mappings */
+        struct spinlock as_lock;	/* protects page table entries */
+        bool as_loading;		/* in load_elf; writes always allowed */
+        unsigned as_nlocked;		/* pages with PTE_LOCKED */
+        uint32_t as_asid;		/* TLB ASID and generation (vmtlb.c) */
+        uint32_t as_cpus;		/* CPUs that may hold its TLB entries */
 #endif
 };
 
@@ -99,6 +147,33 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_sbrk   - move the end of the heap by AMOUNT bytes and hand back
+ *                the old end. The heap starts out empty at the end of
+ *                the loaded program.
+ *
+ *    as_mmap   - map LEN bytes of V at OFFSET (or zeros, if V is NULL)
+ *                with protection PROT (PROT_*) and MAP_* FLAGS, and
+ *                hand back the address chosen. With MAP_FIXED, the
+ *                mapping goes at ADDR, which must not be in use;
+ *                otherwise it goes in the highest gap that fits.
+ *
+ *    as_munmap - remove mappings made by as_mmap from [ADDR, ADDR+LEN).
+ *
+ *    as_madvise - apply MADV_* ADVICE to [ADDR, ADDR+LEN).
+ *
+ *    as_mincore - fill VEC with a byte per page for the NPAGES pages at
+ *                ADDR, with MINCORE_INCORE set for the resident ones.
+ *
+ *    as_mlock  - lock [ADDR, ADDR+LEN) into memory, or unlock it if
+ *                !LOCK. Fails with EAGAIN if too much of memory is
+ *                locked already.
+ *
+ *    as_findregion - return the region containing VADDR, or NULL.
+ *
+ *    as_define_file - arrange for FILESIZE bytes at VADDR, which must lie
+ *                within a region already defined, to be read from V at
+ *                OFFSET when first touched. Takes a reference to V.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -117,6 +192,24 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbreak);
+int               as_mmap(struct addrspace *as, vaddr_t addr, size_t len,
+                          int prot, int flags, struct vnode *v, off_t offset,
+                          vaddr_t *ret);
+int               as_munmap(struct addrspace *as, vaddr_t addr, size_t len);
+int               as_madvise(struct addrspace *as, vaddr_t addr, size_t len,
+                             int advice);
+int               as_mincore(struct addrspace *as, vaddr_t addr,
+                             unsigned npages, unsigned char *vec);
+int               as_mlock(struct addrspace *as, vaddr_t addr, size_t len,
+                           bool lock);
+#if !OPT_DUMBVM
+struct region    *as_findregion(struct addrspace *as, vaddr_t vaddr);
+int               as_define_file(struct addrspace *as, vaddr_t vaddr,
+                                 size_t filesize, struct vnode *v,
+                                 off_t offset);
+#endif
 
 
 /*
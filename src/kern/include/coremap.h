@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Physical page allocator.
+ *
+ * The coremap has one entry for every physical page of RAM, as
+ * reported by ram_getsize(). Pages that were already in use when the
+ * VM system started (the kernel image, the exception vectors, and
+ * anything ram_stealmem() handed out during early boot) are marked
+ * fixed and are never given out or taken back.
+ *
+ * Free pages are managed with a binary buddy system: free memory is
+ * kept as aligned blocks of 2^k pages, one doubly linked list per
+ * size threaded through the coremap entries. An allocation takes the
+ * smallest block that holds it, splitting bigger blocks as needed and
+ * freeing any tail beyond the pages asked for, and freed pages are
+ * merged with their buddies as far as possible. This keeps free
+ * memory in large pieces, so the multi-page (physically contiguous)
+ * allocations needed for kernel stacks and large kmallocs keep
+ * succeeding after long uptimes. The length of each allocation is
+ * recorded in its first entry so the whole run can be released by
+ * address alone.
+ *
+ * In front of that, each CPU keeps a small magazine of free pages in
+ * its struct cpu, refilled from and drained to the free lists in
+ * batches, so most single-page allocations and frees don't take the
+ * coremap lock. (Freeing a user page still takes it briefly, to drop
+ * the reference and check for a pageout in progress.) Magazines are
+ * only refilled while memory is plentiful.
+ *
+ * Single pages may be shared, e.g. between a parent and child after
+ * fork. Each allocation carries a reference count, and coremap_free
+ * only releases the pages when the last reference is dropped.
+ *
+ * Pages holding user memory record the address space and virtual
+ * address that map them, so the pageout daemon can find the page
+ * table entry to update when it evicts one. Only unshared pages have
+ * an owner; a page stops having one when it becomes shared and gets
+ * one back when a copy-on-write fault takes it over. Pages shared by
+ * fork also keep a list of the mappings fork knows about; when all
+ * but one reference is gone and the last is on that list, it becomes
+ * the owner again, so the page can be paged out.
+ *
+ * A page is busy while it is being filled or written out. Busy pages
+ * are never chosen for eviction, and coremap_free waits for a busy
+ * page before releasing it, so a page's owner cannot go away while
+ * the pageout daemon is working on the page.
+ *
+ * The free page count is kept between two watermarks. When it drops
+ * below the low one the pageout daemon is woken, and it evicts pages
+ * until the count is back above the high one. User page allocations
+ * wait for the daemon rather than dig into the last few pages, which
+ * are kept for the kernel.
+ */
+
+#include <machine/vm.h>
+
+struct addrspace;
+struct coremap_mapper;
+
+/* Spare mapper entries coremap_sharemap may need. */
+#define COREMAP_MAPPERS_NEEDED	2
+
+/* Page states */
+#define CME_FREE	0	/* part of a free buddy block */
+#define CME_FIXED	1	/* in use since boot; never freed */
+#define CME_KERNEL	2	/* allocated by coremap_alloc */
+#define CME_USER	3	/* allocated by coremap_alloc_user */
+#define CME_CACHED	4	/* free, in some CPU's magazine */
+
+struct coremap_entry {
+	unsigned cme_next;		/* free list links (page numbers) */
+	unsigned cme_prev;
+	unsigned cme_npages;		/* length of allocation or free block */
+	unsigned cme_state;		/* CME_* */
+	unsigned cme_refcount;		/* references to this allocation */
+	bool cme_busy;			/* I/O or setup in progress */
+	struct addrspace *cme_as;	/* owner of a user page, or NULL */
+	vaddr_t cme_va;			/* where the owner maps it */
+	struct coremap_mapper *cme_mappers; /* known mappings, if shared */
+	uint32_t cme_lastuse;		/* when last seen referenced (ms) */
+};
+
+/*
+ * Functions:
+ *
+ *    coremap_bootstrap  - take over physical memory from ram.c. Called
+ *                         once from vm_bootstrap.
+ *    coremap_isready    - true once coremap_bootstrap has run; before
+ *                         that, callers must use ram_stealmem.
+ *    coremap_alloc      - allocate NPAGES physically contiguous pages.
+ *                         Returns 0 if no suitable run is available.
+ *    coremap_free       - drop a reference to an allocation made by
+ *                         coremap_alloc, given its first page, and
+ *                         release it if that was the last one. Fixed
+ *                         pages are ignored.
+ *    coremap_share      - add a reference to a single-page allocation.
+ *                         The page loses its owner.
+ *    coremap_refcount   - return the number of references to a page.
+ *    coremap_totalpages - return the number of pages of RAM.
+ *    coremap_printstats - print page usage counts.
+ *
+ * For user pages:
+ *
+ *    coremap_alloc_user - allocate a page to be mapped at VA in AS. The
+ *                         page comes back busy. May sleep waiting for
+ *                         the pageout daemon. Returns 0 if no memory.
+ *    coremap_setowner   - record AS/VA as the owner of an unshared page.
+ *    coremap_sharemap   - add a reference to a page mapped at VA, for
+ *                         NEWAS to map at VA too (fork).
+ *                         Both mappings are remembered. SPARE holds
+ *                         COREMAP_MAPPERS_NEEDED entries from
+ *                         coremap_mapper_create; used ones are set to
+ *                         NULL. Does not sleep.
+ *    coremap_unmap      - like coremap_free, for the reference held by
+ *                         the mapping of the page at VA in AS.
+ *    coremap_mapper_create  - allocate an entry for coremap_sharemap.
+ *    coremap_mapper_destroy - free one that wasn't used.
+ *    coremap_unbusy     - clear the busy flag and wake any waiters.
+ *    coremap_waitbusy   - wait until the page at PA is not busy.
+ *    coremap_lockpage   - count a page locked with mlock. Returns false
+ *                         if too many pages are locked already.
+ *    coremap_unlockpage - uncount one.
+ *
+ * For the pageout daemon:
+ *
+ *    coremap_pageout_start - enable watermarks and waiting for pageout.
+ *    coremap_pageout_wait  - sleep until there is work to do.
+ *    coremap_pageout_needed - true while below the high watermark.
+ *    coremap_pageout_done  - report whether a round freed anything and
+ *                            wake waiting allocations.
+ *    coremap_pickvictim    - choose an owned, unshared, non-busy user
+ *                            page, mark it busy, and return it with
+ *                            its owner. Returns 0 if there is none.
+ *                            Candidates come in clock-hand order, or
+ *                            from a random starting point if USERANDOM.
+ *    coremap_age           - for a page being considered by the daemon:
+ *                            if REFERENCED, record NOW as its last use.
+ *                            Returns the time since its last use.
+ *    coremap_userpages     - number of user pages allocated.
+ */
+
+void coremap_bootstrap(void);
+bool coremap_isready(void);
+paddr_t coremap_alloc(unsigned npages);
+void coremap_free(paddr_t pa);
+void coremap_share(paddr_t pa);
+unsigned coremap_refcount(paddr_t pa);
+unsigned coremap_totalpages(void);
+void coremap_printstats(void);
+
+paddr_t coremap_alloc_user(struct addrspace *as, vaddr_t va);
+void coremap_setowner(paddr_t pa, struct addrspace *as, vaddr_t va);
+void coremap_sharemap(paddr_t pa, struct addrspace *newas, vaddr_t va,
+		      struct coremap_mapper **spare);
+void coremap_unmap(paddr_t pa, struct addrspace *as, vaddr_t va);
+struct coremap_mapper *coremap_mapper_create(void);
+void coremap_mapper_destroy(struct coremap_mapper *cm);
+void coremap_unbusy(paddr_t pa);
+void coremap_waitbusy(paddr_t pa);
+bool coremap_lockpage(void);
+void coremap_unlockpage(void);
+
+void coremap_pageout_start(void);
+void coremap_pageout_wait(void);
+bool coremap_pageout_needed(void);
+void coremap_pageout_done(bool progress);
+paddr_t coremap_pickvictim(bool userandom, struct addrspace **as, vaddr_t *va);
+uint32_t coremap_age(paddr_t pa, uint32_t now, bool referenced);
+unsigned coremap_userpages(void);
+
+
+#endif /* _COREMAP_H_ */
@@ -35,6 +35,9 @@
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
+/* Maximum number of free pages each cpu keeps for itself. */
+#define CPU_PAGEMAG 16
+
 
 /*
  * Per-cpu structure
@@ -62,6 +65,19 @@ struct cpu {
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
 
+	/*
+	 * Accessed only by this cpu, with interrupts off.
+	 *
+	 * A magazine of free physical pages (page numbers), so most
+	 * page allocations and frees can skip the coremap lock, and
+	 * changes to the coremap's page counts not yet added in. See
+	 * vm/coremap.c.
+	 */
+	unsigned c_pagemag[CPU_PAGEMAG];
+	unsigned c_npagemag;
+	unsigned c_pagemag_nuser;
+	unsigned c_pagemag_nkernel;
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
@@ -82,10 +98,20 @@ struct cpu {
 	 * The contents of struct tlbshootdown are also machine-
 	 * dependent and might reasonably be either an address space
 	 * and vaddr pair, or a paddr, or something else.
+	 *
+	 * If the queue overflows, c_shootdown_all is set and the CPU
+	 * flushes its whole TLB instead. Each shootdown IPI sent gets
+	 * a ticket from c_shootdown_sent; c_shootdown_done is the
+	 * last ticket handled, and c_shootdown_wchan is where senders
+	 * wait for it to catch up.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	unsigned c_numshootdown;
+	bool c_shootdown_all;
+	unsigned c_shootdown_sent;
+	unsigned c_shootdown_done;
+	struct wchan *c_shootdown_wchan;
 	struct spinlock c_ipi_lock;
 
 	/*
@@ -117,6 +143,11 @@ void cpu_hatch(unsigned software_number);
  */
 void cpu_identify(char *buf, size_t max);
 
+/*
+ * Look up a CPU by its number (c_number); NULL if there isn't one.
+ */
+struct cpu *cpu_bynumber(unsigned num);
+
 /*
  * Hardware-level interrupt on/off, for the current CPU.
  *
@@ -156,6 +187,13 @@ void cpu_halt(void);
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
  *
+ * To batch several invalidations into one interrupt, and not wait for
+ * them unless necessary, use the pieces separately:
+ * ipi_tlbshootdown_queue adds TLB shootdown data to a CPU's queue
+ * without interrupting it; ipi_tlbshootdown_send interrupts it to
+ * handle everything queued and returns a ticket; and
+ * ipi_tlbshootdown_wait waits until that ticket has been handled.
+ *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
  */
@@ -169,6 +207,10 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_queue(struct cpu *target,
+			    const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown_send(struct cpu *target);
+void ipi_tlbshootdown_wait(struct cpu *target, unsigned ticket);
 
 void interprocessor_interrupt(void);
 
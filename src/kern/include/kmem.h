@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _KMEM_H_
+#define _KMEM_H_
+
+/*
+ * Object caches.
+ *
+ * An object cache hands out objects of one fixed size. Free objects
+ * are kept in their constructed state: the constructor runs when the
+ * cache first gets memory for an object from kmalloc, and the
+ * destructor only when that memory goes back, so the parts of an
+ * object that are the same in every use (embedded lists, locks, and
+ * the like) are set up once rather than on every allocation. Callers
+ * must give objects back in the state the constructor left them.
+ *
+ * A cache keeps at most KMEM_CACHE_MAXFREE free objects; beyond that,
+ * freed objects are destroyed and returned to kmalloc.
+ */
+
+#define KMEM_CACHE_MAXFREE 16
+
+struct kmem_cache; /* Opaque */
+
+/*
+ * Functions:
+ *
+ *    kmem_cache_create     - create a cache of SIZE-byte objects named
+ *                            NAME. CTOR and DTOR may be NULL. CTOR
+ *                            returns 0 or an error code. NAME should
+ *                            be a string constant. Returns NULL if out
+ *                            of memory.
+ *    kmem_cache_destroy    - destroy a cache. All its objects must have
+ *                            been freed.
+ *    kmem_cache_alloc      - get a constructed object; NULL on failure.
+ *    kmem_cache_free       - give back an object. NULL is ignored.
+ *    kmem_cache_printstats - print usage of all caches.
+ */
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+void kmem_cache_printstats(void);
+
+
+#endif /* _KMEM_H_ */
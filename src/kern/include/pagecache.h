@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+/*
+ * Page cache for file-backed memory.
+ *
+ * Pages of file-backed regions (program text and data, and files
+ * mapped with mmap) are looked up here instead of being read
+ * privately, so every address space running the same executable maps
+ * the same physical pages. Writable mappings get the cached page
+ * read-only and copy it on the first write. SFS also serves read()
+ * into user memory from here, so reading a file and mapping it
+ * share the same pages.
+ *
+ * Entries are keyed by vnode and by which bytes of the file the page
+ * holds: SKIP bytes of zeros, LEN bytes from the file at
+ * OFFSET, then zeros to the end of the page. (The first and last
+ * pages of a segment are partly zero; in the usual case every other
+ * page is a full page of the file.)
+ *
+ * The cache holds one coremap reference to each page; each mapping
+ * holds another page reference. A page nobody maps any more stays
+ * cached until the pageout daemon reclaims it, which costs no I/O.
+ *
+ * The cache does not hold vnode references, so it doesn't keep files
+ * or filesystems busy. Instead, filesystems whose files may be cached
+ * must call pagecache_invalidate from their reclaim function, before
+ * the vnode goes away. (SFS and emufs do.)
+ *
+ * Nothing here notices if the file is written. Code that writes files
+ * that may be cached must call pagecache_invalidate_range after the
+ * new contents are in place. (SFS does, while still holding the
+ * biglock; emufs does too.) Each vnode carries a generation that
+ * invalidation bumps, and pagecache_get rereads rather than caching
+ * a page it read before the write.
+ *
+ * Functions:
+ *
+ *    pagecache_get        - find or read in the page described above,
+ *                           and return it with a reference added for
+ *                           the caller. Sleeps.
+ *    pagecache_lookup     - same, but only if the page is already
+ *                           cached; never sleeps, so may be called
+ *                           with an address space's as_lock held.
+ *                           Returns false if it isn't cached.
+ *    pagecache_put        - drop a reference from pagecache_get that
+ *                           isn't being kept in a page table.
+ *    pagecache_reclaim    - free up to NPAGES cached pages that nobody
+ *                           maps. Returns the number freed.
+ *    pagecache_invalidate - drop V's unmapped pages from the cache and
+ *                           forget about the mapped ones.
+ *    pagecache_invalidate_range - same, but only for pages holding any
+ *                           of the file from START up to END.
+ *    pagecache_flush      - reclaim everything unmapped; for shutdown.
+ *    pagecache_printstats - print cache counts.
+ */
+
+#include <machine/vm.h>
+
+struct vnode;
+
+int pagecache_get(struct vnode *v, off_t offset, size_t skip, size_t len,
+		  paddr_t *ret);
+bool pagecache_lookup(struct vnode *v, off_t offset, size_t skip,
+		      size_t len, paddr_t *ret);
+void pagecache_put(paddr_t pa);
+unsigned pagecache_reclaim(unsigned npages);
+void pagecache_invalidate(struct vnode *v);
+void pagecache_invalidate_range(struct vnode *v, off_t start, off_t end);
+void pagecache_flush(void);
+void pagecache_printstats(void);
+
+
+#endif /* _PAGECACHE_H_ */
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PAGEOUT_H_
+#define _PAGEOUT_H_
+
+/*
+ * Pageout daemon.
+ *
+ * A kernel thread that sleeps until the coremap's free page count
+ * drops below its low watermark (or an allocation is waiting for
+ * memory), and then writes user pages out to swap until the count is
+ * back up to the high watermark. Faulting threads normally never do
+ * pageout I/O themselves; they only wait for the daemon when memory
+ * is down to the kernel's reserve.
+ *
+ * Victims are chosen by WSClock by default. Since MIPS has no
+ * reference bit, it is emulated: the daemon clears PTE_VALID and
+ * shoots down the TLB entry, and the next access refaults and sets it
+ * again. FIFO and random replacement are also available.
+ *
+ * Without swap space, the daemon can still reclaim unmapped pages from
+ * the page cache.
+ *
+ * Pages locked with mlock (PTE_LOCKED) are never evicted. Pages a
+ * sequential reader has left behind can be marked as long unused, so
+ * WSClock evicts them ahead of anything still in a working set.
+ *
+ *    pageout_bootstrap  - start the daemon. Called from vm_bootstrap.
+ *    pageout_setpolicy  - select the replacement policy by name
+ *                         ("fifo", "random", or "wsclock").
+ *    pageout_printstats - print the policy and eviction counts.
+ *    pageout_deactivate - mark the page at VA in AS as not recently
+ *                         used, unless it is locked or shared.
+ */
+
+/* Replacement policies */
+#define PAGEOUT_FIFO	0
+#define PAGEOUT_RANDOM	1
+#define PAGEOUT_WSCLOCK	2
+
+void pageout_bootstrap(void);
+int pageout_setpolicy(const char *name);
+void pageout_printstats(void);
+
+struct addrspace;
+void pageout_deactivate(struct addrspace *as, vaddr_t va);
+
+
+#endif /* _PAGEOUT_H_ */
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Per-address-space page table.
+ *
+ * Two levels, indexed by the top ten and next ten bits of the virtual
+ * address. The directory and each second-level table are exactly one
+ * page. Second-level tables are allocated only when something in
+ * their 4M span is first touched, so sparse address spaces are cheap.
+ *
+ * A page table entry is laid out like the MIPS TLB EntryLo word, so
+ * a resident entry can be written into the TLB after masking off the
+ * software bits. The low byte is ignored by the hardware and is used
+ * for software state.
+ *
+ * There is no hardware reference bit. A resident entry has
+ * PTE_RESIDENT set, and PTE_VALID only while it is considered
+ * referenced; the pageout daemon clears PTE_VALID (and shoots down the
+ * TLB entry) to find out whether the page gets used again, and
+ * vm_fault sets it when it does.
+ *
+ * A non-resident entry is one of:
+ *    0                      - never touched; zero-fill on demand.
+ *    slot | PTE_SWAPPED     - on swap; the slot number is kept in the
+ *                             frame bits.
+ *    frame | PTE_BUSY       - being paged out. The frame is busy in the
+ *                             coremap; wait for it and look again.
+ *
+ * A resident entry with PTE_LOCKED set was locked with mlock and is
+ * never paged out.
+ *
+ * The UTLB refill handler in exception-mips1.S walks this structure
+ * directly and has the shifts and PTE_VALID wired in; change them
+ * together.
+ */
+
+#include <machine/vm.h>
+
+typedef uint32_t pte_t;
+
+/* Hardware bits (same values as TLBLO_*) */
+#define PTE_FRAME	0xfffff000	/* physical page number */
+#define PTE_DIRTY	0x00000400	/* writable */
+#define PTE_VALID	0x00000200	/* resident and referenced */
+
+/* Software bits */
+#define PTE_SWAPPED	0x00000001	/* contents are in swap */
+#define PTE_BUSY	0x00000002	/* pageout in progress */
+#define PTE_RESIDENT	0x00000004	/* frame bits are a page of RAM */
+#define PTE_LOCKED	0x00000008	/* resident page may not be evicted */
+
+#define PTE_SLOT(pte)	((pte) >> PT_L2SHIFT)
+#define PTE_MKSWAP(slot) (((pte_t)(slot) << PT_L2SHIFT) | PTE_SWAPPED)
+
+/* Bits that may be loaded into the TLB. */
+#define PTE_TLBBITS	(PTE_FRAME | PTE_DIRTY | PTE_VALID)
+
+#define PT_L1SHIFT	22
+#define PT_L2SHIFT	12
+#define PT_ENTRIES	1024		/* entries per level */
+#define PT_L1INDEX(va)	((va) >> PT_L1SHIFT)
+#define PT_L2INDEX(va)	(((va) >> PT_L2SHIFT) & (PT_ENTRIES - 1))
+
+struct pagetable {
+	pte_t *pt_dir[PT_ENTRIES];	/* second-level tables, or NULL */
+};
+
+/*
+ * Functions:
+ *
+ *    pt_create  - allocate an empty page table.
+ *    pt_destroy - free the table structure. Does not touch the pages
+ *                 the entries refer to; the caller must have dealt
+ *                 with those already.
+ *    pt_lookup  - return a pointer to the entry for VA. If CREATE is
+ *                 set, allocate the second-level table if needed;
+ *                 otherwise return NULL if there isn't one. Also
+ *                 returns NULL if out of memory.
+ */
+
+struct pagetable *pt_create(void);
+void pt_destroy(struct pagetable *pt);
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t va, bool create);
+
+
+#endif /* _PAGETABLE_H_ */
@@ -63,6 +63,7 @@ struct proc {
 	char *p_name;			/* Name of this process */
 	struct spinlock p_lock;		/* Lock for this structure */
 	unsigned p_numthreads;		/* Number of threads in this process */
+	pid_t p_pid;			/* Process id */
 
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
@@ -82,6 +83,9 @@ void proc_bootstrap(void);
 /* Create a fresh process for use by runprogram(). */
 struct proc *proc_create_runprogram(const char *name);
 
+/* Create a child of the current process for fork(). */
+struct proc *proc_create_fork(const char *name);
+
 /* Destroy a process. */
 void proc_destroy(struct proc *proc);
 
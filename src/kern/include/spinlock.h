@@ -37,6 +37,7 @@
 
 #include <cdefs.h>
 #include <hangman.h>
+#include "opt-splstats.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -46,18 +47,48 @@
 /* Get the machine-dependent bits. */
 #include <machine/spinlock.h>
 
+/*
+ * Contention statistics, compiled in with "options splstats". Every
+ * spinlock is kept on a list so the hottest ones can be found; the
+ * counters are only ever updated by the CPU holding the lock.
+ */
+#if OPT_SPLSTATS
+struct spinlock_stats {
+	struct spinlock *ss_next;	/* List of all spinlocks. */
+	struct spinlock *ss_prev;
+	bool ss_listed;			/* On the list yet? */
+	uint64_t ss_acquires;		/* Times acquired. */
+	uint64_t ss_contended;		/* Times we had to wait. */
+	uint64_t ss_spins;		/* Loops spent waiting. */
+	vaddr_t ss_lastpc;		/* Caller that last had to wait. */
+};
+#define SPINLOCK_STATS(sym)	struct spinlock_stats sym;
+#define SPINLOCK_STATS_INITIALIZER	{ NULL, NULL, false, 0, 0, 0, 0 },
+#else
+#define SPINLOCK_STATS(sym)
+#define SPINLOCK_STATS_INITIALIZER
+#endif
+
 /*
  * Basic spinlock.
  *
  * Note that spinlocks are held by CPUs, not by threads.
  *
+ * This is a ticket lock: each CPU that wants the lock takes the next
+ * number from splk_next and waits until splk_serving reaches it. So
+ * CPUs get the lock in the order they asked for it, and only the
+ * single atomic increment of splk_next is done against a contended
+ * cache line; waiters just read splk_serving.
+ *
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
  */
 struct spinlock {
-	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
+	volatile spinlock_data_t splk_next; /* Next ticket to hand out. */
+	volatile spinlock_data_t splk_serving; /* Ticket now holding it. */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
+	SPINLOCK_STATS(splk_stats)	    /* Contention counters. */
 	HANGMAN_LOCKABLE(splk_hangman);     /* Deadlock detector hook. */
 };
 
@@ -65,10 +96,14 @@ struct spinlock {
  * Initializer for cases where a spinlock needs to be static or global.
  */
 #ifdef OPT_HANGMAN
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, \
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, NULL, \
+				  SPINLOCK_STATS_INITIALIZER \
 				  HANGMAN_LOCKABLE_INITIALIZER }
 #else
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, NULL, \
+				  SPINLOCK_STATS_INITIALIZER }
 #endif
 
 /*
@@ -81,6 +116,8 @@ struct spinlock {
  * release	Release the lock. May re-enable interrupts.
  *
  * do_i_hold	Check if the current CPU holds the lock.
+ *
+ * printstats	Print the most contended spinlocks. (splstats only)
  */
 
 void spinlock_init(struct spinlock *lk);
@@ -91,5 +128,9 @@ void spinlock_release(struct spinlock *lk);
 
 bool spinlock_do_i_hold(struct spinlock *lk);
 
+#if OPT_SPLSTATS
+void spinlock_printstats(void);
+#endif
+
 
 #endif /* _SPINLOCK_H_ */
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space.
+ *
+ * Evicted user pages are written to the raw second disk (lhd1raw:),
+ * one page per slot. Slot allocation is tracked with a bitmap. Since
+ * fork shares everything, including pages that are out on swap, each
+ * slot also has a reference count.
+ *
+ * Slots are grouped into clusters of SWAP_CLUSTER. Pages from the same
+ * aligned SWAP_CLUSTER-page block of an address space are put in the
+ * same cluster, at the same position, when possible, so a run of
+ * neighboring pages can be read back with one request and the disk
+ * doesn't seek between them.
+ *
+ * Pages may be kept compressed in memory instead of written to the
+ * disk; see zswap.h. That's invisible from here.
+ *
+ * If there is no swap disk, swap_alloc always fails and nothing is
+ * ever paged out.
+ */
+
+#include <machine/vm.h>
+
+#define SWAP_CLUSTER	8		/* slots per cluster */
+#define SWAP_NOSLOT	((unsigned)-1)
+
+/*
+ * Functions:
+ *
+ *    swap_bootstrap  - open the swap device. Called from vm_bootstrap.
+ *    swap_enabled    - true if there is a swap device.
+ *    swap_alloc      - allocate a slot: WANT if it is free (WANT may
+ *                      be SWAP_NOSLOT), otherwise position POS of an
+ *                      empty cluster, otherwise any. Returns ENOSPC if
+ *                      there are none.
+ *    swap_share      - add a reference to a slot.
+ *    swap_free       - drop a reference to a slot.
+ *    swap_read       - read slot SLOT into the page at PA.
+ *    swap_readrun    - read the NPAGES (at most SWAP_CLUSTER) slots
+ *                      starting at SLOT into the pages in PAS, in one
+ *                      request.
+ *    swap_write      - write the page at PA into slot SLOT.
+ *    swap_printstats - print slot usage and I/O counts.
+ *
+ * swap_read and swap_write sleep.
+ */
+
+void swap_bootstrap(void);
+bool swap_enabled(void);
+int swap_alloc(unsigned want, unsigned pos, unsigned *slot);
+void swap_share(unsigned slot);
+void swap_free(unsigned slot);
+int swap_read(unsigned slot, paddr_t pa);
+int swap_readrun(unsigned slot, const paddr_t *pas, unsigned npages);
+int swap_write(unsigned slot, paddr_t pa);
+void swap_printstats(void);
+
+
+#endif /* _SWAP_H_ */
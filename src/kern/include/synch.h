@@ -71,12 +71,21 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * The lock is adaptive: the owner is kept in one word that is claimed
+ * with compare-and-swap, so an uncontended acquire or release is a
+ * few instructions. A thread that finds the lock held spins for a
+ * while if the owner is running on another CPU (and so will probably
+ * let go soon), and otherwise sleeps on lk_wchan. Releasing a lock
+ * that has sleepers hands it directly to the one woken up.
  */
 struct lock {
         char *lk_name;
         HANGMAN_LOCKABLE(lk_hangman);   /* Deadlock detector hook. */
-        // add what you need here
-        // (don't forget to mark things volatile as needed)
+	volatile spinlock_data_t lk_owner; /* holding thread, or 0 */
+	volatile unsigned lk_waiters;	/* threads (about to be) asleep */
+	struct spinlock lk_spinlock;	/* protects lk_wchan, lk_waiters */
+	struct wchan *lk_wchan;
 };
 
 struct lock *lock_create(const char *name);
@@ -112,10 +121,17 @@ bool lock_do_i_hold(struct lock *);
  * (should be) made internally.
  */
 
+/*
+ * Waiters are never woken straight off the CV. cv_signal and
+ * cv_broadcast move them onto the wait channel of the lock (which the
+ * caller holds), and each then gets the lock handed to it in turn as
+ * it is released, rather than all of them waking up to fight over it.
+ */
 struct cv {
         char *cv_name;
-        // add what you need here
-        // (don't forget to mark things volatile as needed)
+	struct wchan *cv_wchan;
+	struct spinlock cv_lock;	/* protects cv_wchan, cv_waiters */
+	unsigned cv_waiters;		/* threads asleep on cv_wchan */
 };
 
 struct cv *cv_create(const char *name);
@@ -139,4 +155,64 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ * The preference given at creation decides who wins when a writer is
+ * waiting and more readers arrive:
+ *
+ *    RW_PREFER_WRITERS - new readers wait behind the writer.
+ *    RW_PREFER_READERS - new readers keep coming in, but only up to
+ *                        RW_READBATCH of them; then they wait too,
+ *                        so writers are not starved.
+ *
+ * Either way, when a writer releases the lock every reader that was
+ * waiting for it gets in before the next writer, so readers are not
+ * starved either. Waiters are handed the lock directly when they are
+ * woken.
+ *
+ * The lock is not recursive, and there is no upgrading or
+ * downgrading between read and write.
+ */
+#define RW_READBATCH 32
+
+enum rwlock_pref {
+	RW_PREFER_WRITERS,
+	RW_PREFER_READERS,
+};
+
+struct rwlock {
+	char *rw_name;
+	struct wchan *rw_readwchan;	/* waiting readers */
+	struct wchan *rw_writewchan;	/* waiting writers */
+	struct spinlock rw_lock;	/* protects everything below */
+	enum rwlock_pref rw_pref;
+	unsigned rw_readers;		/* readers holding the lock */
+	bool rw_writing;		/* a writer holds the lock */
+	struct thread *rw_writer;	/* which writer, once it's running */
+	unsigned rw_readwaiters;	/* readers asleep */
+	unsigned rw_writewaiters;	/* writers asleep */
+	unsigned rw_batch;		/* readers let past a waiting writer */
+};
+
+struct rwlock *rwlock_create(const char *name, enum rwlock_pref pref);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading.
+ *    rwlock_release_read  - Free a read hold.
+ *    rwlock_acquire_write - Get the lock for writing, alone.
+ *    rwlock_release_write - Free the write hold.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                           the lock for writing.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
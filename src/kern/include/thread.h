@@ -85,6 +85,14 @@ struct thread {
 	struct proc *t_proc;		/* Process thread belongs to */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
 
+	/*
+	 * Scheduler fields; see schedule() in thread.c. Changed only
+	 * by the CPU running the thread, or by whoever holds the run
+	 * queue or wait channel lock the thread is on.
+	 */
+	unsigned t_level;		/* Queue level; 0 runs first */
+	unsigned t_ticks;		/* Hardclocks used at this level */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -153,15 +161,20 @@ __DEAD void thread_exit(void);
 
 /*
  * Cause the current thread to yield to the next runnable thread, but
- * itself stay runnable.
+ * itself stay runnable. The next thread is the head of the run queue
+ * whatever its level; the current thread goes back on the queue in
+ * level order. If nothing else is runnable, it just returns.
  * Interrupts need not be disabled.
  */
 void thread_yield(void);
 
 /*
- * Reshuffle the run queue. Called from the timer interrupt.
+ * Charge the current thread for a hardclock and adjust priorities.
+ * Returns true if the current thread should yield: a thread at a
+ * higher level is waiting, or its quantum is used up and a thread at
+ * its level is waiting. Called from the timer interrupt.
  */
-void schedule(void);
+bool schedule(void);
 
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
@@ -57,6 +57,14 @@ void free_kpages(vaddr_t addr);
 
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
+void vm_tlbshootdown_all(void);
+
+/* Paging hints, for madvise and mlock */
+struct addrspace;
+struct region;
+void vm_prefetch(struct addrspace *as, struct region *rg, vaddr_t va);
+int vm_lockpage(struct addrspace *as, struct region *rg, vaddr_t va,
+		bool lock);
 
 
 #endif /* _VM_H_ */
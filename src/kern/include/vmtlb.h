@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _VMTLB_H_
+#define _VMTLB_H_
+
+/*
+ * TLB management for the VM system.
+ *
+ * Translations are tagged with the address space's ASID (see
+ * vm/vmtlb.c), so they survive switches between address spaces.
+ * All of these do their own locking and interrupt disabling, and
+ * only vmtlb_shootdown sleeps.
+ *
+ *    vmtlb_activate   - switch this CPU to AS: load its ASID, getting
+ *                       it a new one if needed, and point the refill
+ *                       handler at its page table.
+ *    vmtlb_deactivate - switch this CPU to no address space.
+ *    vmtlb_forget     - AS is being destroyed; make sure no CPU
+ *                       still refers to it.
+ *
+ *    vmtlb_load       - enter a translation for VA in the current
+ *                       address space on this CPU, replacing any
+ *                       existing entry for the same page. ELO is the
+ *                       EntryLo word (frame and DIRTY/VALID bits).
+ *    vmtlb_invalidate - remove this CPU's translations for the NPAGES
+ *                       pages at VA tagged with PID (EntryHi PID
+ *                       bits), if present.
+ *    vmtlb_flush      - remove all of this CPU's translations.
+ *
+ *    vmtlb_unmap      - remove AS's translations for the NPAGES pages
+ *                       at VA on every CPU.
+ *                       AS must not be running on another CPU; it's
+ *                       normally the current process's.
+ *    vmtlb_unmapall   - same, for all of AS's translations.
+ *
+ * Shootdowns, for when AS may be running on other CPUs (e.g. pageout
+ * taking a page away from some process) go through a vmtlb_pending,
+ * which collects requests so each CPU gets at most one interrupt per
+ * batch, and only CPUs AS has run on are bothered at all:
+ *
+ *    vmtlb_shootdown_init  - start an empty batch.
+ *    vmtlb_shootdown_add   - remove AS's translations for the NPAGES
+ *                            pages at VA. This CPU's are removed at
+ *                            once; other CPUs' are queued.
+ *    vmtlb_shootdown_send  - interrupt the CPUs with queued requests.
+ *                            Doesn't wait; the batch can be added to
+ *                            and sent again.
+ *    vmtlb_shootdown_wait  - send, then wait until all requests in the
+ *                            batch have been carried out. Sleeps.
+ *    vmtlb_shootdown       - all of the above for one page.
+ *
+ * A batch that isn't waited for must at least be sent.
+ */
+
+#include <platform/maxcpus.h>
+
+struct addrspace;
+
+struct vmtlb_pending {
+	uint32_t vp_queued;		/* CPUs with requests queued */
+	uint32_t vp_sent;		/* CPUs interrupted */
+	unsigned vp_ticket[MAXCPUS];	/* ticket from each CPU's IPI */
+};
+
+void vmtlb_activate(struct addrspace *as);
+void vmtlb_deactivate(void);
+void vmtlb_forget(struct addrspace *as);
+
+void vmtlb_load(vaddr_t va, uint32_t elo);
+void vmtlb_invalidate(vaddr_t va, unsigned npages, uint32_t pid);
+void vmtlb_flush(void);
+
+void vmtlb_unmap(struct addrspace *as, vaddr_t va, unsigned npages);
+void vmtlb_unmapall(struct addrspace *as);
+
+void vmtlb_shootdown_init(struct vmtlb_pending *vp);
+void vmtlb_shootdown_add(struct vmtlb_pending *vp, struct addrspace *as,
+			 vaddr_t va, unsigned npages);
+void vmtlb_shootdown_send(struct vmtlb_pending *vp);
+void vmtlb_shootdown_wait(struct vmtlb_pending *vp);
+void vmtlb_shootdown(struct addrspace *as, vaddr_t va);
+
+void vmtlb_printstats(void);
+
+
+#endif /* _VMTLB_H_ */
@@ -47,6 +47,9 @@ struct stat;
  * Abstract low-level file.
  *
  * Note: vn_fs may be null if the vnode refers to a device.
+ *
+ * vn_cachegen and vn_cachepages belong to the page cache (see
+ * pagecache.h) and are protected by its lock.
  */
 struct vnode {
 	int vn_refcount;                /* Reference count */
@@ -57,6 +60,9 @@ struct vnode {
 	void *vn_data;                  /* Filesystem-specific data */
 
 	const struct vnode_ops *vn_ops; /* Functions on this vnode */
+
+	unsigned vn_cachegen;           /* Page cache invalidations */
+	unsigned vn_cachepages;         /* Pages in the page cache */
 };
 
 /*
@@ -120,9 +126,10 @@ struct vnode {
  *    vop_fsync       - Force any dirty buffers associated with this file
  *                      to stable storage.
  *
- *    vop_mmap        - Map file into memory. If you implement this
- *                      feature, you're responsible for choosing the
- *                      arguments for this operation.
+ *    vop_mmap        - Check that the file can be mapped into memory.
+ *                      The VM system does the mapping itself, reading
+ *                      pages through the page cache with vop_read;
+ *                      this only lets the object refuse.
  *
  *    vop_truncate    - Forcibly set size of file to the length passed
  *                      in, discarding any excess blocks.
@@ -76,5 +76,13 @@ void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Move up to N threads sleeping on FROM over to TO without waking
+ * them; they will wake when TO is woken instead. Both associated
+ * spinlocks must be locked. Returns the number of threads moved.
+ */
+unsigned wchan_requeue(struct wchan *from, struct spinlock *fromlk,
+		       struct wchan *to, struct spinlock *tolk, unsigned n);
+
 
 #endif /* _WCHAN_H_ */
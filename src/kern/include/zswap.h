@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _ZSWAP_H_
+#define _ZSWAP_H_
+
+/*
+ * Compressed swap cache.
+ *
+ * A pool of compressed pages in kernel memory that sits in front of
+ * the swap disk. swap_write offers each page to it first; if the page
+ * compresses to at most half a page and the pool has room, it is kept
+ * here, keyed by its swap slot, and the disk is never touched.
+ * swap_read and swap_readrun look here before going to the disk.
+ * The slot is still allocated on the disk, so fork's slot sharing and
+ * the slot reference counts work as before, and the entry goes away
+ * when the slot is freed.
+ *
+ * Pages are compressed with a small LZ77 compressor in the style of
+ * LZ4: runs of literal bytes alternating with back-references into
+ * the page, with no entropy coding, so it is cheap in both directions.
+ *
+ * The pool is capped at a number of pages' worth of memory,
+ * ZSWAP_MAXPAGES by default. The cap can be changed with zswap_setmax
+ * (the "zswap" menu command, which can be given on the kernel command
+ * line at boot); 0 turns the pool off. When the pool is full, pages go to
+ * the disk as before.
+ *
+ * Functions:
+ *
+ *    zswap_bootstrap  - set up for NSLOTS swap slots. Called from
+ *                       swap_bootstrap.
+ *    zswap_store      - try to keep the page at PA for SLOT. Returns
+ *                       true if it was kept. May sleep.
+ *    zswap_load       - if SLOT's page is kept here, uncompress it into
+ *                       the page at PA and return true.
+ *    zswap_drop       - forget SLOT's page, if there is one.
+ *    zswap_setmax     - set the cap, in pages.
+ *    zswap_printstats - print the size, compression ratio, and hit
+ *                       rate.
+ */
+
+#include <machine/vm.h>
+
+void zswap_bootstrap(unsigned nslots);
+bool zswap_store(unsigned slot, paddr_t pa);
+bool zswap_load(unsigned slot, paddr_t pa);
+void zswap_drop(unsigned slot);
+void zswap_setmax(unsigned npages);
+void zswap_printstats(void);
+
+
+#endif /* _ZSWAP_H_ */
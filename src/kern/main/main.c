@@ -50,6 +50,10 @@
 #include <test.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
+#include "opt-paging.h"
+#if OPT_PAGING
+#include <pagecache.h>
+#endif
 
 
 /*
@@ -152,6 +156,10 @@ shutdown(void)
 
 	vfs_clearbootfs();
 	vfs_clearcurdir();
+#if OPT_PAGING
+	/* Give back cached file pages. */
+	pagecache_flush();
+#endif
 	vfs_unmountall();
 
 	thread_shutdown();
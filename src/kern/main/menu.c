@@ -33,6 +33,7 @@
 #include <kern/unistd.h>
 #include <limits.h>
 #include <lib.h>
+#include <kmem.h>
 #include <uio.h>
 #include <clock.h>
 #include <mainbus.h>
@@ -45,6 +46,17 @@
 #include <test.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-paging.h"
+#include "opt-splstats.h"
+
+#if OPT_PAGING
+#include <coremap.h>
+#include <swap.h>
+#include <zswap.h>
+#include <pageout.h>
+#include <pagecache.h>
+#include <vmtlb.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -461,6 +473,7 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
+	kmem_cache_printstats();
 
 	return 0;
 }
@@ -494,6 +507,76 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_SPLSTATS
+static
+int
+cmd_splstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	spinlock_printstats();
+
+	return 0;
+}
+#endif
+
+#if OPT_PAGING
+static
+int
+cmd_coremapstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	coremap_printstats();
+	swap_printstats();
+	zswap_printstats();
+	pageout_printstats();
+	pagecache_printstats();
+	vmtlb_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for choosing the page replacement policy.
+ */
+static
+int
+cmd_vmpolicy(int nargs, char **args)
+{
+	if (nargs != 2) {
+		kprintf("Usage: vmpolicy fifo|random|wsclock\n");
+		return EINVAL;
+	}
+	return pageout_setpolicy(args[1]);
+}
+
+/*
+ * Command for setting the size of the compressed swap cache.
+ */
+static
+int
+cmd_zswap(int nargs, char **args)
+{
+	int npages;
+
+	if (nargs != 2) {
+		kprintf("Usage: zswap maxpages\n");
+		return EINVAL;
+	}
+	npages = atoi(args[1]);
+	if (npages < 0 || (unsigned)npages > coremap_totalpages()) {
+		kprintf("Usage: zswap maxpages\n");
+		kprintf("    maxpages is 0 to %u\n", coremap_totalpages());
+		return EINVAL;
+	}
+	zswap_setmax(npages);
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -536,6 +619,10 @@ static const char *opsmenu[] = {
 	"[debug]   Drop to debugger          ",
 	"[panic]   Intentional panic         ",
 	"[deadlock] Intentional deadlock     ",
+#if OPT_PAGING
+	"[vmpolicy] Page replacement policy  ",
+	"[zswap]   Compressed swap size      ",
+#endif
 	"[q]       Quit and shut down        ",
 	NULL
 };
@@ -570,6 +657,7 @@ static const char *testmenu[] = {
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
 	"[sy4] CV test #2            (1)     ",
+	"[rw]  RW lock test                  ",
 	"[semu1-22] Semaphore unit tests     ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
@@ -601,6 +689,12 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+#if OPT_PAGING
+	"[cm] Physical memory stats          ",
+#endif
+#if OPT_SPLSTATS
+	"[spl] Spinlock contention stats     ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -644,6 +738,10 @@ static struct {
 	{ "debug",	cmd_debug },
 	{ "panic",	cmd_panic },
 	{ "deadlock",	cmd_deadlock },
+#if OPT_PAGING
+	{ "vmpolicy",	cmd_vmpolicy },
+	{ "zswap",	cmd_zswap },
+#endif
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
 	{ "halt",	cmd_quit },
@@ -652,6 +750,12 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+#if OPT_PAGING
+	{ "cm",         cmd_coremapstats },
+#endif
+#if OPT_SPLSTATS
+	{ "spl",        cmd_splstats },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -674,6 +778,7 @@ static struct {
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "rw",		rwtest },
 
 	/* semaphore unit tests */
 	{ "semu1",	semu1 },
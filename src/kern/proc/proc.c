@@ -43,6 +43,7 @@
  */
 
 #include <types.h>
+#include <limits.h>
 #include <spl.h>
 #include <proc.h>
 #include <current.h>
@@ -54,6 +55,26 @@
  */
 struct proc *kproc;
 
+/*
+ * Next process id to hand out. There is no process table yet, so ids
+ * are simply issued in sequence and wrap at PID_MAX.
+ */
+static struct spinlock pid_lock = SPINLOCK_INITIALIZER;
+static pid_t pid_next = PID_MIN;
+
+static
+pid_t
+pid_alloc(void)
+{
+	pid_t pid;
+
+	spinlock_acquire(&pid_lock);
+	pid = pid_next;
+	pid_next = (pid_next == PID_MAX) ? PID_MIN : pid_next + 1;
+	spinlock_release(&pid_lock);
+	return pid;
+}
+
 /*
  * Create a proc structure.
  */
@@ -75,6 +96,7 @@ proc_create(const char *name)
 
 	proc->p_numthreads = 0;
 	spinlock_init(&proc->p_lock);
+	proc->p_pid = pid_alloc();
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
@@ -221,6 +243,32 @@ proc_create_runprogram(const char *name)
 	return newproc;
 }
 
+/*
+ * Create a proc for the child side of fork.
+ *
+ * Like proc_create_runprogram, it has no address space yet (the caller
+ * copies the parent's) and shares the current process's directory.
+ */
+struct proc *
+proc_create_fork(const char *name)
+{
+	struct proc *newproc;
+
+	newproc = proc_create(name);
+	if (newproc == NULL) {
+		return NULL;
+	}
+
+	spinlock_acquire(&curproc->p_lock);
+	if (curproc->p_cwd != NULL) {
+		VOP_INCREF(curproc->p_cwd);
+		newproc->p_cwd = curproc->p_cwd;
+	}
+	spinlock_release(&curproc->p_lock);
+
+	return newproc;
+}
+
 /*
  * Add a thread to a process. Either the thread or the process might
  * or might not be current.
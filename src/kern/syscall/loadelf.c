@@ -42,8 +42,9 @@
  * circumstances, as_prepare_load and as_complete_load probably don't
  * need to do anything.
  *
- * If you wanted to support memory-mapped executables you would need
- * to rearrange this to map each segment.
+ * With the paging VM system, segments aren't actually read here:
+ * map_segment attaches the file to each region and the pages are read
+ * in as they are touched. With dumbvm, load_segment reads each one in.
  *
  * To support dynamically linked executables with shared libraries
  * you'd need to change this to load the "ELF interpreter" (dynamic
@@ -52,6 +53,7 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/stat.h>
 #include <lib.h>
 #include <uio.h>
 #include <proc.h>
@@ -60,6 +62,7 @@
 #include <vnode.h>
 #include <elf.h>
 
+#if OPT_DUMBVM
 /*
  * Load a segment at virtual address VADDR. The segment in memory
  * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
@@ -145,6 +148,54 @@ load_segment(struct addrspace *as, struct vnode *v,
 	return result;
 }
 
+#else /* !OPT_DUMBVM */
+
+/*
+ * Map a segment at virtual address VADDR. Arguments are as for
+ * load_segment above, but nothing is read now; the VM system pages
+ * the segment in from the file when it is touched, and supplies zeros
+ * for the part past FILESIZE.
+ *
+ * Since nothing is read, check here that the file is long enough;
+ * otherwise a truncated executable would only fail when the missing
+ * part was touched, and the process would die on a page fault.
+ */
+static
+int
+map_segment(struct addrspace *as, struct vnode *v,
+	    off_t offset, vaddr_t vaddr,
+	    size_t memsize, size_t filesize)
+{
+	struct stat st;
+	int result;
+
+	if (filesize > memsize) {
+		kprintf("ELF: warning: segment filesize > segment memsize\n");
+		filesize = memsize;
+	}
+
+	DEBUG(DB_EXEC, "ELF: Mapping %lu bytes at 0x%lx\n",
+	      (unsigned long) filesize, (unsigned long) vaddr);
+
+	if (filesize == 0) {
+		/* Nothing from the file; the region is all zeros. */
+		return 0;
+	}
+
+	result = VOP_STAT(v, &st);
+	if (result) {
+		return result;
+	}
+	if (offset < 0 || offset + (off_t)filesize > st.st_size) {
+		kprintf("ELF: segment past end of file - file truncated?\n");
+		return ENOEXEC;
+	}
+
+	return as_define_file(as, vaddr, filesize, v, offset);
+}
+
+#endif /* OPT_DUMBVM */
+
 /*
  * Load an ELF executable user program into the current address space.
  *
@@ -259,7 +310,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	}
 
 	/*
-	 * Now actually load each segment.
+	 * Now actually load (or map) each segment.
 	 */
 
 	for (i=0; i<eh.e_phnum; i++) {
@@ -288,9 +339,14 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+#if OPT_DUMBVM
 		result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
 				      ph.p_memsz, ph.p_filesz,
 				      ph.p_flags & PF_X);
+#else
+		result = map_segment(as, v, ph.p_offset, ph.p_vaddr,
+				     ph.p_memsz, ph.p_filesz);
+#endif
 		if (result) {
 			return result;
 		}
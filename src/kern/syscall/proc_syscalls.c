@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <machine/trapframe.h>
+#include <proc.h>
+#include <thread.h>
+#include <current.h>
+#include <addrspace.h>
+#include <syscall.h>
+
+/*
+ * Thread entry point for the child of fork. DATA1 is a heap copy of
+ * the parent's trapframe.
+ */
+static
+void
+fork_child_entry(void *data1, unsigned long data2)
+{
+	(void)data2;
+	enter_forked_process(data1);
+}
+
+/*
+ * fork: duplicate the current process. The address space is copied
+ * with as_copy, which shares pages copy-on-write, so the cost doesn't
+ * depend on how much the parent has written.
+ */
+int
+sys_fork(struct trapframe *tf, pid_t *retval)
+{
+	struct proc *newproc;
+	struct trapframe *childtf;
+	struct addrspace *as;
+	pid_t pid;
+	int result;
+
+	childtf = kmalloc(sizeof(*childtf));
+	if (childtf == NULL) {
+		return ENOMEM;
+	}
+	*childtf = *tf;
+
+	newproc = proc_create_fork(curproc->p_name);
+	if (newproc == NULL) {
+		kfree(childtf);
+		return ENOMEM;
+	}
+
+	as = proc_getas();
+	KASSERT(as != NULL);
+	result = as_copy(as, &newproc->p_addrspace);
+	if (result) {
+		proc_destroy(newproc);
+		kfree(childtf);
+		return result;
+	}
+
+	/* Once the child is running it may go away; don't touch it. */
+	pid = newproc->p_pid;
+	result = thread_fork(curthread->t_name, newproc,
+			     fork_child_entry, childtf, 0);
+	if (result) {
+		proc_destroy(newproc);
+		kfree(childtf);
+		return result;
+	}
+
+	*retval = pid;
+	return 0;
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Memory management system calls.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+/*
+ * sbrk: move the heap break and return the old one. The work is done
+ * by as_sbrk; the break must stay page-aligned.
+ */
+int
+sys_sbrk(intptr_t amount, int32_t *retval)
+{
+	struct addrspace *as;
+	vaddr_t oldbreak;
+	int result;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+
+	result = as_sbrk(as, amount, &oldbreak);
+	if (result) {
+		return result;
+	}
+	*retval = (int32_t)oldbreak;
+	return 0;
+}
+
+/*
+ * mmap: the fd and offset arguments are on the user stack, but there
+ * is no file table to look the fd up in yet, so only anonymous
+ * mappings can be made from userlevel. (as_mmap takes a vnode and
+ * handles files.)
+ */
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags, int32_t *retval)
+{
+	struct addrspace *as;
+	vaddr_t va;
+	int result;
+
+	if ((flags & MAP_ANON) == 0) {
+		return EBADF;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+
+	result = as_mmap(as, (vaddr_t)addr, len, prot, flags, NULL, 0, &va);
+	if (result) {
+		return result;
+	}
+	*retval = (int32_t)va;
+	return 0;
+}
+
+/*
+ * munmap: as_munmap does the work.
+ */
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+	struct addrspace *as;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EINVAL;
+	}
+	return as_munmap(as, (vaddr_t)addr, len);
+}
+
+/*
+ * madvise: as_madvise does the work.
+ */
+int
+sys_madvise(userptr_t addr, size_t len, int advice)
+{
+	struct addrspace *as;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	return as_madvise(as, (vaddr_t)addr, len, advice);
+}
+
+/* Pages of mincore results to collect before copying them out. */
+#define MINCORE_CHUNK 64
+
+/*
+ * mincore: one byte per page of [ADDR, ADDR+LEN) is written to VEC.
+ */
+int
+sys_mincore(userptr_t addr, size_t len, userptr_t vec)
+{
+	struct addrspace *as;
+	unsigned char buf[MINCORE_CHUNK];
+	vaddr_t va;
+	size_t npages, done, n;
+	int result;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+
+	va = (vaddr_t)addr;
+	if ((va & PAGE_FRAME) != va) {
+		return EINVAL;
+	}
+	npages = len / PAGE_SIZE + (len % PAGE_SIZE != 0);
+
+	for (done = 0; done < npages; done += n) {
+		n = npages - done;
+		if (n > MINCORE_CHUNK) {
+			n = MINCORE_CHUNK;
+		}
+		result = as_mincore(as, va + done * PAGE_SIZE, n, buf);
+		if (result) {
+			return result;
+		}
+		result = copyout(buf, (userptr_t)((char *)vec + done), n);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * mlock and munlock: as_mlock does the work.
+ */
+int
+sys_mlock(userptr_t addr, size_t len)
+{
+	struct addrspace *as;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	return as_mlock(as, (vaddr_t)addr, len, true);
+}
+
+int
+sys_munlock(userptr_t addr, size_t len)
+{
+	struct addrspace *as;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	return as_mlock(as, (vaddr_t)addr, len, false);
+}
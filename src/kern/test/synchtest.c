@@ -34,6 +34,7 @@
 #include <types.h>
 #include <lib.h>
 #include <clock.h>
+#include <spinlock.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
@@ -399,3 +400,161 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Reader-writer lock test.
+ *
+ * Writers update the three test values together under the write
+ * lock; readers check they are consistent, and that no writer is in
+ * while they are. Readers also count how many of them are in at once,
+ * so we can see whether reading actually happens in parallel. The
+ * test runs once with each preference.
+ */
+
+#define NRWLOOPS	200
+#define NRWWRITERS	4
+
+static struct rwlock *testrw;
+static struct spinlock rwcountlock = SPINLOCK_INITIALIZER;
+static volatile unsigned rwreaders, rwmaxreaders, rwwriters;
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: %s\n", num, msg);
+	kprintf("Test failed\n");
+	V(donesem);
+	thread_exit();
+}
+
+static
+void
+rwreaderthread(void *junk, unsigned long num)
+{
+	unsigned long val;
+	volatile int j;
+	int i;
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		rwlock_acquire_read(testrw);
+
+		spinlock_acquire(&rwcountlock);
+		if (rwwriters != 0) {
+			spinlock_release(&rwcountlock);
+			rwlock_release_read(testrw);
+			rwfail(num, "Reader in with a writer");
+		}
+		rwreaders++;
+		if (rwreaders > rwmaxreaders) {
+			rwmaxreaders = rwreaders;
+		}
+		spinlock_release(&rwcountlock);
+
+		val = testval1;
+		for (j=0; j<200; j++);
+		if (testval2 != val*val || testval3 != val%3) {
+			rwlock_release_read(testrw);
+			rwfail(num, "Mismatch on testvals");
+		}
+
+		spinlock_acquire(&rwcountlock);
+		rwreaders--;
+		spinlock_release(&rwcountlock);
+
+		rwlock_release_read(testrw);
+	}
+	V(donesem);
+}
+
+static
+void
+rwwriterthread(void *junk, unsigned long num)
+{
+	volatile int j;
+	int i;
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS/4; i++) {
+		rwlock_acquire_write(testrw);
+		KASSERT(rwlock_do_i_hold_write(testrw));
+
+		spinlock_acquire(&rwcountlock);
+		if (rwwriters != 0 || rwreaders != 0) {
+			spinlock_release(&rwcountlock);
+			rwlock_release_write(testrw);
+			rwfail(num, "Writer not alone");
+		}
+		rwwriters++;
+		spinlock_release(&rwcountlock);
+
+		testval1 = num;
+		for (j=0; j<200; j++);
+		testval2 = num*num;
+		testval3 = num%3;
+
+		spinlock_acquire(&rwcountlock);
+		rwwriters--;
+		spinlock_release(&rwcountlock);
+
+		rwlock_release_write(testrw);
+	}
+	V(donesem);
+}
+
+static
+void
+rwtest_one(enum rwlock_pref pref, const char *prefname)
+{
+	int i, result;
+
+	testrw = rwlock_create("testrw", pref);
+	if (testrw == NULL) {
+		panic("rwtest: rwlock_create failed\n");
+	}
+	testval1 = testval2 = testval3 = 0;
+	rwreaders = rwmaxreaders = rwwriters = 0;
+
+	kprintf("Preferring %s...\n", prefname);
+	for (i=0; i<NTHREADS; i++) {
+		if (i % (NTHREADS / NRWWRITERS) == 0) {
+			result = thread_fork("rwtest", NULL, rwwriterthread,
+					     NULL, i);
+		}
+		else {
+			result = thread_fork("rwtest", NULL, rwreaderthread,
+					     NULL, i);
+		}
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+	kprintf("Most readers at once: %u\n", rwmaxreaders);
+
+	rwlock_destroy(testrw);
+	testrw = NULL;
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting rwlock test...\n");
+	rwtest_one(RW_PREFER_WRITERS, "writers");
+	rwtest_one(RW_PREFER_READERS, "readers");
+	kprintf("rwlock test done.\n");
+
+	return 0;
+}
@@ -43,6 +43,140 @@
  * Spinlocks.
  */
 
+#if OPT_SPLSTATS
+
+/*
+ * List of all spinlocks, for spinlock_printstats. It is protected by
+ * a bare lock word rather than a spinlock, since spinlocks use it.
+ * Hold it only at IPL_HIGH.
+ */
+static volatile spinlock_data_t splstats_lock = SPINLOCK_DATA_INITIALIZER;
+static struct spinlock *splstats_list;
+
+/* How many spinlocks spinlock_printstats shows. */
+#define SPLSTATS_NTOP 16
+
+static
+void
+splstats_lockall(void)
+{
+	while (spinlock_data_get(&splstats_lock) != 0 ||
+	       spinlock_data_testandset(&splstats_lock) != 0) {
+		/* spin */
+	}
+	membar_store_any();
+}
+
+static
+void
+splstats_unlockall(void)
+{
+	membar_any_store();
+	spinlock_data_set(&splstats_lock, 0);
+}
+
+/*
+ * Put a spinlock on the list. Spinlocks made with SPINLOCK_INITIALIZER
+ * get here the first time they're acquired. Call at IPL_HIGH.
+ */
+static
+void
+splstats_add(struct spinlock *splk)
+{
+	splstats_lockall();
+	splk->splk_stats.ss_prev = NULL;
+	splk->splk_stats.ss_next = splstats_list;
+	if (splstats_list != NULL) {
+		splstats_list->splk_stats.ss_prev = splk;
+	}
+	splstats_list = splk;
+	splk->splk_stats.ss_listed = true;
+	splstats_unlockall();
+}
+
+/*
+ * Take a spinlock off the list. Call at IPL_HIGH.
+ */
+static
+void
+splstats_remove(struct spinlock *splk)
+{
+	struct spinlock_stats *ss = &splk->splk_stats;
+
+	splstats_lockall();
+	if (ss->ss_prev != NULL) {
+		ss->ss_prev->splk_stats.ss_next = ss->ss_next;
+	}
+	else {
+		KASSERT(splstats_list == splk);
+		splstats_list = ss->ss_next;
+	}
+	if (ss->ss_next != NULL) {
+		ss->ss_next->splk_stats.ss_prev = ss->ss_prev;
+	}
+	ss->ss_listed = false;
+	splstats_unlockall();
+}
+
+/*
+ * Print the spinlocks that have spent the most time spinning. Copy
+ * the numbers out first; we can't print with the list locked.
+ */
+void
+spinlock_printstats(void)
+{
+	struct {
+		struct spinlock *splk;
+		struct spinlock_stats ss;
+	} top[SPLSTATS_NTOP];
+	struct spinlock *splk;
+	unsigned ntop, nlocks, i, j;
+	int spl;
+
+	ntop = nlocks = 0;
+
+	spl = splhigh();
+	splstats_lockall();
+	for (splk = splstats_list; splk != NULL;
+	     splk = splk->splk_stats.ss_next) {
+		nlocks++;
+		if (splk->splk_stats.ss_contended == 0) {
+			continue;
+		}
+		/* Insertion sort into top[], most spins first. */
+		for (i = ntop; i > 0; i--) {
+			if (top[i-1].ss.ss_spins >= splk->splk_stats.ss_spins) {
+				break;
+			}
+		}
+		if (i == SPLSTATS_NTOP) {
+			continue;
+		}
+		if (ntop < SPLSTATS_NTOP) {
+			ntop++;
+		}
+		for (j = ntop - 1; j > i; j--) {
+			top[j] = top[j-1];
+		}
+		top[i].splk = splk;
+		top[i].ss = splk->splk_stats;
+	}
+	splstats_unlockall();
+	splx(spl);
+
+	kprintf("Spinlocks: %u, contended: %u shown\n", nlocks, ntop);
+	kprintf("%-10s %10s %10s %12s %s\n", "lock", "acquires",
+		"contended", "spins", "last waiter");
+	for (i=0; i<ntop; i++) {
+		kprintf("%p %10llu %10llu %12llu 0x%lx\n", top[i].splk,
+			(unsigned long long)top[i].ss.ss_acquires,
+			(unsigned long long)top[i].ss.ss_contended,
+			(unsigned long long)top[i].ss.ss_spins,
+			(unsigned long)top[i].ss.ss_lastpc);
+	}
+}
+
+#endif /* OPT_SPLSTATS */
 
 /*
  * Initialize spinlock.
@@ -50,9 +184,23 @@
 void
 spinlock_init(struct spinlock *splk)
 {
-	spinlock_data_set(&splk->splk_lock, 0);
+	spinlock_data_set(&splk->splk_next, 0);
+	spinlock_data_set(&splk->splk_serving, 0);
 	splk->splk_holder = NULL;
 	HANGMAN_LOCKABLEINIT(&splk->splk_hangman, "spinlock");
+#if OPT_SPLSTATS
+	{
+		int spl;
+
+		splk->splk_stats.ss_acquires = 0;
+		splk->splk_stats.ss_contended = 0;
+		splk->splk_stats.ss_spins = 0;
+		splk->splk_stats.ss_lastpc = 0;
+		spl = splhigh();
+		splstats_add(splk);
+		splx(spl);
+	}
+#endif
 }
 
 /*
@@ -62,20 +210,48 @@ void
 spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
-	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	KASSERT(spinlock_data_get(&splk->splk_next) ==
+		spinlock_data_get(&splk->splk_serving));
+#if OPT_SPLSTATS
+	if (splk->splk_stats.ss_listed) {
+		int spl;
+
+		spl = splhigh();
+		splstats_remove(splk);
+		splx(spl);
+	}
+#endif
+}
+
+/*
+ * Take the next ticket. This is the only read-modify-write on the
+ * lock; retry until the LL/SC goes through.
+ */
+static
+spinlock_data_t
+spinlock_taketicket(struct spinlock *splk)
+{
+	spinlock_data_t ticket;
+
+	do {
+		ticket = spinlock_data_get(&splk->splk_next);
+	} while (!spinlock_data_cas(&splk->splk_next, ticket, ticket + 1));
+	return ticket;
 }
 
 /*
  * Get the lock.
  *
  * First disable interrupts (otherwise, if we get a timer interrupt we
- * might come back to this lock and deadlock), then use a machine-level
- * atomic operation to wait for the lock to be free.
+ * might come back to this lock and deadlock), then take a ticket and
+ * wait for our turn.
  */
 void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+	spinlock_data_t ticket;
+	unsigned spins;
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -93,40 +269,44 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu = NULL;
 	}
 
-	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&splk->splk_lock) != 0) {
-			continue;
-		}
-		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
-			continue;
-		}
-		break;
+	ticket = spinlock_taketicket(splk);
+	spins = 0;
+	while (spinlock_data_get(&splk->splk_serving) != ticket) {
+		spins++;
 	}
 
 	membar_store_any();
 	splk->splk_holder = mycpu;
 
+#if OPT_SPLSTATS
+	if (!splk->splk_stats.ss_listed) {
+		splstats_add(splk);
+	}
+	splk->splk_stats.ss_acquires++;
+	if (spins > 0) {
+		splk->splk_stats.ss_contended++;
+		splk->splk_stats.ss_spins += spins;
+		splk->splk_stats.ss_lastpc =
+			(vaddr_t)__builtin_return_address(0);
+	}
+#else
+	(void)spins;
+#endif
+
 	if (CURCPU_EXISTS()) {
 		HANGMAN_ACQUIRE(&curcpu->c_hangman, &splk->splk_hangman);
 	}
 }
 
 /*
- * Release the lock.
+ * Release the lock. Only the holder writes splk_serving, so this
+ * needs no atomic operation.
  */
 void
 spinlock_release(struct spinlock *splk)
 {
+	spinlock_data_t serving;
+
 	/* this must work before curcpu initialization */
 	if (CURCPU_EXISTS()) {
 		KASSERT(splk->splk_holder == curcpu->c_self);
@@ -136,8 +316,9 @@ spinlock_release(struct spinlock *splk)
 	}
 
 	splk->splk_holder = NULL;
+	serving = spinlock_data_get(&splk->splk_serving);
 	membar_any_store();
-	spinlock_data_set(&splk->splk_lock, 0);
+	spinlock_data_set(&splk->splk_serving, serving + 1);
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -37,7 +37,9 @@
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
+#include <cpu.h>
 #include <current.h>
+#include <membar.h>
 #include <synch.h>
 
 ////////////////////////////////////////////////////////////
@@ -138,11 +140,30 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+/*
+ * How many times to look at a held lock whose owner is running on
+ * another CPU before going to sleep anyway. Owners normally hold
+ * locks for much less than this; the limit is for the ones that
+ * don't, e.g. because they're waiting for I/O under the lock.
+ */
+#define LOCK_MAXSPIN 2000
+
+/* The value of lk_owner when curthread holds the lock. */
+#define LOCK_ME ((spinlock_data_t)curthread)
+
+/*
+ * The value of lk_owner while the lock is being handed to a sleeping
+ * thread. Only the thread woken by lock_release can change it.
+ */
+#define LOCK_HANDOFF ((spinlock_data_t)1)
+
 struct lock *
 lock_create(const char *name)
 {
         struct lock *lock;
 
+	COMPILE_ASSERT(sizeof(struct thread *) == sizeof(spinlock_data_t));
+
         lock = kmalloc(sizeof(*lock));
         if (lock == NULL) {
                 return NULL;
@@ -154,9 +175,18 @@ lock_create(const char *name)
                 return NULL;
         }
 
+	lock->lk_wchan = wchan_create(lock->lk_name);
+	if (lock->lk_wchan == NULL) {
+		kfree(lock->lk_name);
+		kfree(lock);
+		return NULL;
+	}
+
 	HANGMAN_LOCKABLEINIT(&lock->lk_hangman, lock->lk_name);
 
-        // add stuff here as needed
+	spinlock_data_set(&lock->lk_owner, 0);
+	lock->lk_waiters = 0;
+	spinlock_init(&lock->lk_spinlock);
 
         return lock;
 }
@@ -165,46 +195,156 @@ void
 lock_destroy(struct lock *lock)
 {
         KASSERT(lock != NULL);
+	KASSERT(spinlock_data_get(&lock->lk_owner) == 0);
+	KASSERT(lock->lk_waiters == 0);
 
-        // add stuff here as needed
-
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&lock->lk_spinlock);
+	wchan_destroy(lock->lk_wchan);
         kfree(lock->lk_name);
         kfree(lock);
 }
 
+/*
+ * Return true if it's worth spinning on a lock held by OWNER: that
+ * is, if OWNER is running right now on some other CPU, or the lock
+ * is being handed off and its new owner is about to run. OWNER may
+ * exit or move at any moment, so this is only a hint. (Thread
+ * structures are never unmapped, so looking at a stale one is
+ * harmless.)
+ */
+static
+bool
+lock_owner_running(spinlock_data_t owner)
+{
+	struct thread *t = (struct thread *)owner;
+
+	if (owner == LOCK_HANDOFF) {
+		return true;
+	}
+	return owner != 0 && t->t_state == S_RUN &&
+		t->t_cpu != curcpu->c_self;
+}
+
+/*
+ * Take ownership of a lock that lock_release handed to us when it
+ * woke us from lk_wchan.
+ */
+static
+void
+lock_takehandoff(struct lock *lock)
+{
+	KASSERT(spinlock_data_get(&lock->lk_owner) == LOCK_HANDOFF);
+	spinlock_data_set(&lock->lk_owner, LOCK_ME);
+	membar_any_any();
+}
+
 void
 lock_acquire(struct lock *lock)
 {
+	spinlock_data_t owner;
+	unsigned spins;
+
+	KASSERT(lock != NULL);
+
+	/* May not block in an interrupt handler. */
+	KASSERT(curthread->t_in_interrupt == false);
+
 	/* Call this (atomically) before waiting for a lock */
-	//HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
 
-        // Write this
+	/* Fast path: nobody has it. */
+	if (spinlock_data_cas(&lock->lk_owner, 0, LOCK_ME)) {
+		goto gotit;
+	}
 
-        (void)lock;  // suppress warning until code gets written
+	if (spinlock_data_get(&lock->lk_owner) == LOCK_ME) {
+		panic("Deadlock on lock %s\n", lock->lk_name);
+	}
+
+	/* Spin while the owner is busy elsewhere. */
+	spins = 0;
+	while (1) {
+		owner = spinlock_data_get(&lock->lk_owner);
+		if (owner == 0) {
+			if (spinlock_data_cas(&lock->lk_owner, 0, LOCK_ME)) {
+				goto gotit;
+			}
+			continue;
+		}
+		if (spins++ >= LOCK_MAXSPIN || !lock_owner_running(owner)) {
+			break;
+		}
+	}
+
+	/*
+	 * Sleep. Register as a waiter before the last try, so that if
+	 * lock_release cleared lk_owner after that try it will have
+	 * seen lk_waiters and will hand the lock to a sleeper.
+	 */
+	spinlock_acquire(&lock->lk_spinlock);
+	lock->lk_waiters++;
+	membar_any_any();
+	if (spinlock_data_cas(&lock->lk_owner, 0, LOCK_ME)) {
+		lock->lk_waiters--;
+		spinlock_release(&lock->lk_spinlock);
+		goto gotit;
+	}
+	wchan_sleep(lock->lk_wchan, &lock->lk_spinlock);
+	spinlock_release(&lock->lk_spinlock);
+	lock_takehandoff(lock);
+
+ gotit:
+	membar_any_any();
 
 	/* Call this (atomically) once the lock is acquired */
-	//HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
 }
 
 void
 lock_release(struct lock *lock)
 {
+	KASSERT(lock != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
 	/* Call this (atomically) when the lock is released */
-	//HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
+	HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
 
-        // Write this
+	membar_any_store();
+	spinlock_data_set(&lock->lk_owner, 0);
 
-        (void)lock;  // suppress warning until code gets written
+	/* Pairs with the barrier after lk_waiters++ in lock_acquire. */
+	membar_any_any();
+	if (lock->lk_waiters == 0) {
+		return;
+	}
+
+	/*
+	 * Hand the lock to a sleeper, unless someone else has taken
+	 * it in the meantime; then it's their job when they release
+	 * it. Everyone counted in lk_waiters is asleep while we hold
+	 * lk_spinlock. Retry the CAS until it succeeds or the lock is
+	 * taken, since it can fail spuriously.
+	 */
+	spinlock_acquire(&lock->lk_spinlock);
+	while (lock->lk_waiters > 0 &&
+	       spinlock_data_get(&lock->lk_owner) == 0) {
+		if (spinlock_data_cas(&lock->lk_owner, 0, LOCK_HANDOFF)) {
+			lock->lk_waiters--;
+			wchan_wakeone(lock->lk_wchan, &lock->lk_spinlock);
+			break;
+		}
+	}
+	spinlock_release(&lock->lk_spinlock);
 }
 
 bool
 lock_do_i_hold(struct lock *lock)
 {
-        // Write this
-
-        (void)lock;  // suppress warning until code gets written
-
-        return true; // dummy until code gets written
+	if (!CURCPU_EXISTS()) {
+		return false;
+	}
+	return spinlock_data_get(&lock->lk_owner) == LOCK_ME;
 }
 
 ////////////////////////////////////////////////////////////
@@ -228,7 +368,15 @@ cv_create(const char *name)
                 return NULL;
         }
 
-        // add stuff here as needed
+	cv->cv_wchan = wchan_create(cv->cv_name);
+	if (cv->cv_wchan == NULL) {
+		kfree(cv->cv_name);
+		kfree(cv);
+		return NULL;
+	}
+
+	spinlock_init(&cv->cv_lock);
+	cv->cv_waiters = 0;
 
         return cv;
 }
@@ -237,33 +385,284 @@ void
 cv_destroy(struct cv *cv)
 {
         KASSERT(cv != NULL);
+	KASSERT(cv->cv_waiters == 0);
 
-        // add stuff here as needed
-
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&cv->cv_lock);
+	wchan_destroy(cv->cv_wchan);
         kfree(cv->cv_name);
         kfree(cv);
 }
 
+/*
+ * Release LOCK and sleep. We only ever wake up from LOCK's wait
+ * channel, having been moved there by cv_signal or cv_broadcast, and
+ * by then lock_release has handed us the lock.
+ *
+ * Hold cv_lock across releasing LOCK so a signal can't slip in
+ * between releasing it and going to sleep. (Lock order: cv_lock,
+ * then the lock's lk_spinlock.)
+ */
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
-        // Write this
-        (void)cv;    // suppress warning until code gets written
-        (void)lock;  // suppress warning until code gets written
+	KASSERT(cv != NULL);
+	KASSERT(lock_do_i_hold(lock));
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&cv->cv_lock);
+	lock_release(lock);
+	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+	cv->cv_waiters++;
+	wchan_sleep(cv->cv_wchan, &cv->cv_lock);
+	spinlock_release(&cv->cv_lock);
+
+	lock_takehandoff(lock);
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+}
+
+/*
+ * Move up to N waiters from CV to LOCK's wait channel. They'll get
+ * the lock, one at a time, as it is released; the first release is
+ * ours.
+ */
+static
+void
+cv_requeue(struct cv *cv, struct lock *lock, unsigned n)
+{
+	unsigned moved;
+
+	KASSERT(cv != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	spinlock_acquire(&cv->cv_lock);
+	if (cv->cv_waiters > 0) {
+		spinlock_acquire(&lock->lk_spinlock);
+		moved = wchan_requeue(cv->cv_wchan, &cv->cv_lock,
+				      lock->lk_wchan, &lock->lk_spinlock, n);
+		KASSERT(moved <= cv->cv_waiters);
+		cv->cv_waiters -= moved;
+		lock->lk_waiters += moved;
+		spinlock_release(&lock->lk_spinlock);
+	}
+	spinlock_release(&cv->cv_lock);
 }
 
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
-        // Write this
-	(void)cv;    // suppress warning until code gets written
-	(void)lock;  // suppress warning until code gets written
+	cv_requeue(cv, lock, 1);
 }
 
 void
 cv_broadcast(struct cv *cv, struct lock *lock)
 {
-	// Write this
-	(void)cv;    // suppress warning until code gets written
-	(void)lock;  // suppress warning until code gets written
+	cv_requeue(cv, lock, (unsigned)-1);
+}
+
+////////////////////////////////////////////////////////////
+//
+// RW lock.
+
+struct rwlock *
+rwlock_create(const char *name, enum rwlock_pref pref)
+{
+	struct rwlock *rw;
+
+	KASSERT(pref == RW_PREFER_WRITERS || pref == RW_PREFER_READERS);
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rw_name = kstrdup(name);
+	if (rw->rw_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rw_readwchan = wchan_create(rw->rw_name);
+	if (rw->rw_readwchan == NULL) {
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rw_writewchan = wchan_create(rw->rw_name);
+	if (rw->rw_writewchan == NULL) {
+		wchan_destroy(rw->rw_readwchan);
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	spinlock_init(&rw->rw_lock);
+	rw->rw_pref = pref;
+	rw->rw_readers = 0;
+	rw->rw_writing = false;
+	rw->rw_writer = NULL;
+	rw->rw_readwaiters = 0;
+	rw->rw_writewaiters = 0;
+	rw->rw_batch = 0;
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_writing == false);
+
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_writewchan);
+	wchan_destroy(rw->rw_readwchan);
+	kfree(rw->rw_name);
+	kfree(rw);
+}
+
+/*
+ * Give the lock to one waiting writer. Call with rw_lock held and
+ * the lock free.
+ */
+static
+void
+rwlock_grant_writer(struct rwlock *rw)
+{
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_writing == false);
+	KASSERT(rw->rw_writewaiters > 0);
+
+	rw->rw_writewaiters--;
+	rw->rw_writing = true;
+	rw->rw_batch = 0;
+	wchan_wakeone(rw->rw_writewchan, &rw->rw_lock);
+}
+
+/*
+ * Give the lock to all waiting readers. Call with rw_lock held and no
+ * writer.
+ */
+static
+void
+rwlock_grant_readers(struct rwlock *rw)
+{
+	KASSERT(rw->rw_writing == false);
+	KASSERT(rw->rw_readwaiters > 0);
+
+	rw->rw_readers += rw->rw_readwaiters;
+	rw->rw_readwaiters = 0;
+	wchan_wakeall(rw->rw_readwchan, &rw->rw_lock);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	bool mayenter;
+
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+
+	if (rw->rw_writing) {
+		mayenter = false;
+	}
+	else if (rw->rw_writewaiters == 0) {
+		mayenter = true;
+	}
+	else if (rw->rw_pref == RW_PREFER_READERS &&
+		 rw->rw_batch < RW_READBATCH) {
+		rw->rw_batch++;
+		mayenter = true;
+	}
+	else {
+		mayenter = false;
+	}
+
+	if (mayenter) {
+		rw->rw_readers++;
+	}
+	else {
+		/* Whoever wakes us counts us in rw_readers. */
+		rw->rw_readwaiters++;
+		wchan_sleep(rw->rw_readwchan, &rw->rw_lock);
+		KASSERT(rw->rw_readers > 0);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_readers > 0);
+	KASSERT(rw->rw_writing == false);
+
+	rw->rw_readers--;
+	if (rw->rw_readers == 0 && rw->rw_writewaiters > 0) {
+		rwlock_grant_writer(rw);
+	}
+	/* Readers only wait for a writer, so none can be waiting now. */
+	KASSERT(rw->rw_readers > 0 || rw->rw_writing ||
+		rw->rw_readwaiters == 0);
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+
+	if (rw->rw_writing == false && rw->rw_readers == 0) {
+		rw->rw_writing = true;
+	}
+	else {
+		/* Whoever wakes us sets rw_writing for us. */
+		rw->rw_writewaiters++;
+		wchan_sleep(rw->rw_writewchan, &rw->rw_lock);
+		KASSERT(rw->rw_writing);
+		KASSERT(rw->rw_writer == NULL);
+	}
+	rw->rw_writer = curthread;
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writing);
+	KASSERT(rw->rw_writer == curthread);
+
+	rw->rw_writer = NULL;
+	rw->rw_writing = false;
+	if (rw->rw_readwaiters > 0) {
+		rwlock_grant_readers(rw);
+	}
+	else if (rw->rw_writewaiters > 0) {
+		rwlock_grant_writer(rw);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+	if (!CURCPU_EXISTS()) {
+		return false;
+	}
+	return rw->rw_writer == curthread;
 }
@@ -50,6 +50,7 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <kmem.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -69,6 +70,12 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Object caches for threads and wait channels. */
+static struct kmem_cache *thread_cache;
+static struct kmem_cache *wchan_cache;
+static int wchan_ctor(void *obj);
+static void wchan_dtor(void *obj);
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -108,6 +115,31 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Constructor and destructor for thread_cache: the parts of a thread
+ * that are the same every time it's used.
+ */
+static
+int
+thread_ctor(void *obj)
+{
+	struct thread *thread = obj;
+
+	thread_machdep_init(&thread->t_machdep);
+	threadlistnode_init(&thread->t_listnode, thread);
+	return 0;
+}
+
+static
+void
+thread_dtor(void *obj)
+{
+	struct thread *thread = obj;
+
+	threadlistnode_cleanup(&thread->t_listnode);
+	thread_machdep_cleanup(&thread->t_machdep);
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -120,28 +152,30 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = kmem_cache_alloc(thread_cache);
 	if (thread == NULL) {
 		return NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
+		kmem_cache_free(thread_cache, thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
 
-	/* Thread subsystem fields */
-	thread_machdep_init(&thread->t_machdep);
-	threadlistnode_init(&thread->t_listnode, thread);
+	/* Thread subsystem fields (t_machdep and t_listnode: thread_ctor) */
 	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
 	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
 
+	/* Scheduler fields: new threads start on the top level */
+	thread->t_level = 0;
+	thread->t_ticks = 0;
+
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
@@ -180,12 +214,23 @@ cpu_create(unsigned hardware_number)
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
 
+	c->c_npagemag = 0;
+	c->c_pagemag_nuser = 0;
+	c->c_pagemag_nkernel = 0;
+
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
 	spinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_all = false;
+	c->c_shootdown_sent = 0;
+	c->c_shootdown_done = 0;
+	c->c_shootdown_wchan = wchan_create("tlbshootdown");
+	if (c->c_shootdown_wchan == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
@@ -252,6 +297,19 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+/*
+ * Look up a CPU by its number (c_number). Returns NULL if there's no
+ * such CPU.
+ */
+struct cpu *
+cpu_bynumber(unsigned num)
+{
+	if (num >= cpuarray_num(&allcpus)) {
+		return NULL;
+	}
+	return cpuarray_get(&allcpus, num);
+}
+
 /*
  * Destroy a thread.
  *
@@ -269,7 +327,9 @@ thread_destroy(struct thread *thread)
 
 	/*
 	 * If you add things to struct thread, be sure to clean them up
-	 * either here or in thread_exit(). (And not both...)
+	 * either here or in thread_exit(). (And not both...) Things set
+	 * up by thread_ctor are cleaned up by thread_dtor, when the
+	 * cache gives the memory back.
 	 */
 
 	/* Thread subsystem fields */
@@ -277,14 +337,14 @@ thread_destroy(struct thread *thread)
 	if (thread->t_stack != NULL) {
 		kfree(thread->t_stack);
 	}
-	threadlistnode_cleanup(&thread->t_listnode);
-	thread_machdep_cleanup(&thread->t_machdep);
+	KASSERT(thread->t_listnode.tln_prev == NULL);
+	KASSERT(thread->t_listnode.tln_next == NULL);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
-	kfree(thread);
+	kmem_cache_free(thread_cache, thread);
 }
 
 /*
@@ -373,6 +433,14 @@ thread_bootstrap(void)
 {
 	cpuarray_init(&allcpus);
 
+	thread_cache = kmem_cache_create("thread", sizeof(struct thread),
+					 thread_ctor, thread_dtor);
+	wchan_cache = kmem_cache_create("wchan", sizeof(struct wchan),
+					wchan_ctor, wchan_dtor);
+	if (thread_cache == NULL || wchan_cache == NULL) {
+		panic("thread_bootstrap: Out of memory\n");
+	}
+
 	/*
 	 * Create the cpu structure for the bootup CPU, the one we're
 	 * currently running on. Assume the hardware number is 0; that
@@ -442,6 +510,29 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Put a thread on a CPU's run queue, behind every thread at its
+ * level or above and ahead of everything below. The queue is kept in
+ * level order, so thread_switch just takes the head. Search from the
+ * tail, as the new thread usually belongs there.
+ */
+static
+void
+thread_runqueue_add(struct cpu *c, struct thread *t)
+{
+	struct thread *prev;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	THREADLIST_FORALL_REV(prev, c->c_runqueue) {
+		if (prev->t_level <= t->t_level) {
+			threadlist_insertafter(&c->c_runqueue, prev, t);
+			return;
+		}
+	}
+	threadlist_addhead(&c->c_runqueue, t);
+}
+
 /*
  * Make a thread runnable.
  *
@@ -466,7 +557,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	thread_runqueue_add(targetcpu, target);
 
 	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
 		/*
@@ -587,11 +678,19 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
-		spinlock_release(&curcpu->c_runqueue_lock);
-		splx(spl);
-		return;
+	/*
+	 * If yielding, the next thread is whoever is at the head of
+	 * the run queue, whatever its level; take it off before we go
+	 * on in level order. If there's nobody, just keep going.
+	 */
+	next = NULL;
+	if (newstate == S_READY) {
+		next = threadlist_remhead(&curcpu->c_runqueue);
+		if (next == NULL) {
+			spinlock_release(&curcpu->c_runqueue_lock);
+			splx(spl);
+			return;
+		}
 	}
 
 	/* Put the thread in the right place. */
@@ -640,14 +739,14 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
-	do {
+	while (next == NULL) {
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
 			cpu_idle();
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
-	} while (next == NULL);
+	}
 	curcpu->c_isidle = false;
 
 	/*
@@ -814,17 +913,91 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multi-level feedback queue. Each thread has a level;
+ * run queues are kept sorted by level (see thread_runqueue_add), and
+ * threads on the same level take turns. A thread that uses up its
+ * quantum at one level sinks to the next, where the quantum is twice
+ * as long. A thread woken from a wait channel rises one level. So
+ * CPU-bound threads end up at the bottom, and threads that mostly
+ * wait for I/O stay near the top and get the CPU as soon as they
+ * wake.
+ *
+ * Every SCHED_BOOST_HARDCLOCKS, everything runnable goes back to the
+ * top, so the bottom levels don't starve, and threads whose behavior
+ * changes get reclassified.
+ *
+ * schedule() is called from hardclock() on every CPU, with the
+ * thread it interrupted still curthread. hardclock() only preempts
+ * the thread if schedule() says to, so a thread keeps the CPU for
+ * its whole quantum unless something at a higher level turns up.
  */
+#define SCHED_LEVELS		4	/* Number of levels. */
+#define SCHED_QUANTUM		2	/* Hardclocks at level 0. */
+#define SCHED_BOOST_HARDCLOCKS	100	/* Boost once a second. */
 
-void
+bool
 schedule(void)
 {
+	struct thread *cur, *t;
+	bool preempt;
+
+	/* If idle, curthread went to sleep; don't charge it. */
+	if (curcpu->c_isidle) {
+		return false;
+	}
+
+	cur = curthread;
+	cur->t_ticks++;
+	preempt = false;
+	if (cur->t_ticks >= ((unsigned)SCHED_QUANTUM << cur->t_level)) {
+		if (cur->t_level < SCHED_LEVELS - 1) {
+			cur->t_level++;
+		}
+		cur->t_ticks = 0;
+		preempt = true;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	if ((curcpu->c_hardclocks % SCHED_BOOST_HARDCLOCKS) == 0) {
+		/* Setting every level the same keeps the queue sorted. */
+		THREADLIST_FORALL(t, curcpu->c_runqueue) {
+			t->t_level = 0;
+			t->t_ticks = 0;
+		}
+		cur->t_level = 0;
+		cur->t_ticks = 0;
+	}
+
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * The queue is sorted, so only the head matters, and it's who
+	 * thread_yield will run. Give it the CPU if it's at a higher
+	 * level, or if our quantum is up and it's at our (possibly
+	 * new) level. Nothing below us gets a turn this way.
 	 */
+	t = curcpu->c_runqueue.tl_head.tln_next->tln_self;
+	if (t == NULL || t->t_level > cur->t_level) {
+		preempt = false;
+	}
+	else if (t->t_level < cur->t_level) {
+		preempt = true;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	return preempt;
+}
+
+/*
+ * Raise a thread that's being woken from a wait channel by one level.
+ * Call with the wait channel's spinlock held.
+ */
+static
+void
+thread_promote(struct thread *t)
+{
+	if (t->t_level > 0) {
+		t->t_level--;
+	}
+	t->t_ticks = 0;
 }
 
 /*
@@ -916,7 +1089,7 @@ thread_consider_migration(void)
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			thread_runqueue_add(c, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -940,7 +1113,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			thread_runqueue_add(curcpu->c_self, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -955,6 +1128,28 @@ thread_consider_migration(void)
  * Wait channel functions
  */
 
+/*
+ * Constructor and destructor for wchan_cache.
+ */
+static
+int
+wchan_ctor(void *obj)
+{
+	struct wchan *wc = obj;
+
+	threadlist_init(&wc->wc_threads);
+	return 0;
+}
+
+static
+void
+wchan_dtor(void *obj)
+{
+	struct wchan *wc = obj;
+
+	threadlist_cleanup(&wc->wc_threads);
+}
+
 /*
  * Create a wait channel. NAME is a symbolic string name for it.
  * This is what's displayed by ps -alx in Unix.
@@ -968,11 +1163,10 @@ wchan_create(const char *name)
 {
 	struct wchan *wc;
 
-	wc = kmalloc(sizeof(*wc));
+	wc = kmem_cache_alloc(wchan_cache);
 	if (wc == NULL) {
 		return NULL;
 	}
-	threadlist_init(&wc->wc_threads);
 	wc->wc_name = name;
 
 	return wc;
@@ -985,8 +1179,8 @@ wchan_create(const char *name)
 void
 wchan_destroy(struct wchan *wc)
 {
-	threadlist_cleanup(&wc->wc_threads);
-	kfree(wc);
+	KASSERT(threadlist_isempty(&wc->wc_threads));
+	kmem_cache_free(wchan_cache, wc);
 }
 
 /*
@@ -1038,9 +1232,34 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 	 * in thread_switch.
 	 */
 
+	thread_promote(target);
 	thread_make_runnable(target, false);
 }
 
+/*
+ * Move sleepers from one wait channel to another.
+ */
+unsigned
+wchan_requeue(struct wchan *from, struct spinlock *fromlk,
+	      struct wchan *to, struct spinlock *tolk, unsigned n)
+{
+	struct thread *target;
+	unsigned moved;
+
+	KASSERT(spinlock_do_i_hold(fromlk));
+	KASSERT(spinlock_do_i_hold(tolk));
+
+	for (moved = 0; moved < n; moved++) {
+		target = threadlist_remhead(&from->wc_threads);
+		if (target == NULL) {
+			break;
+		}
+		target->t_wchan_name = to->wc_name;
+		threadlist_addtail(&to->wc_threads, target);
+	}
+	return moved;
+}
+
 /*
  * Wake up all threads sleeping on a wait channel.
  */
@@ -1068,6 +1287,7 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	 * make each thread runnable.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
+		thread_promote(target);
 		thread_make_runnable(target, false);
 	}
 
@@ -1127,39 +1347,76 @@ ipi_broadcast(int code)
 }
 
 /*
- * Send a TLB shootdown IPI to the specified CPU.
+ * Queue a TLB shootdown for the specified CPU, without interrupting
+ * it yet; ipi_tlbshootdown_send does that. If the queue is full, the
+ * CPU is told to flush its whole TLB instead, which covers this
+ * request and everything else queued.
  */
 void
-ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+ipi_tlbshootdown_queue(struct cpu *target, const struct tlbshootdown *mapping)
 {
 	unsigned n;
 
 	spinlock_acquire(&target->c_ipi_lock);
 
 	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
-		/*
-		 * If you have problems with this panic going off,
-		 * consider: (1) increasing the maximum, (2) putting
-		 * logic here to sleep until space appears (may
-		 * interact awkwardly with VM system locking), (3)
-		 * putting logic here to coalesce requests together,
-		 * and/or (4) improving VM system state tracking to
-		 * reduce the number of unnecessary shootdowns.
-		 */
-		panic("ipi_tlbshootdown: Too many shootdowns queued\n");
+	if (target->c_shootdown_all) {
+		/* Already flushing everything. */
+	}
+	else if (n == TLBSHOOTDOWN_MAX) {
+		target->c_shootdown_all = true;
+		target->c_numshootdown = 0;
 	}
 	else {
 		target->c_shootdown[n] = *mapping;
 		target->c_numshootdown = n+1;
 	}
 
+	spinlock_release(&target->c_ipi_lock);
+}
+
+/*
+ * Send a TLB shootdown IPI to the specified CPU, covering everything
+ * queued for it so far. Returns a ticket for ipi_tlbshootdown_wait.
+ */
+unsigned
+ipi_tlbshootdown_send(struct cpu *target)
+{
+	unsigned ticket;
+
+	spinlock_acquire(&target->c_ipi_lock);
+	ticket = ++target->c_shootdown_sent;
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
+	spinlock_release(&target->c_ipi_lock);
 
+	return ticket;
+}
+
+/*
+ * Wait until the specified CPU has handled the shootdown IPI that
+ * returned TICKET (and with it everything queued before it).
+ */
+void
+ipi_tlbshootdown_wait(struct cpu *target, unsigned ticket)
+{
+	spinlock_acquire(&target->c_ipi_lock);
+	while ((int)(target->c_shootdown_done - ticket) < 0) {
+		wchan_sleep(target->c_shootdown_wchan, &target->c_ipi_lock);
+	}
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Send a TLB shootdown IPI to the specified CPU.
+ */
+void
+ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+{
+	ipi_tlbshootdown_queue(target, mapping);
+	ipi_tlbshootdown_send(target);
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
@@ -1201,10 +1458,18 @@ interprocessor_interrupt(void)
 		 * need to release the ipi lock while calling
 		 * vm_tlbshootdown.
 		 */
-		for (i=0; i<curcpu->c_numshootdown; i++) {
-			vm_tlbshootdown(&curcpu->c_shootdown[i]);
+		if (curcpu->c_shootdown_all) {
+			vm_tlbshootdown_all();
+			curcpu->c_shootdown_all = false;
+		}
+		else {
+			for (i=0; i<curcpu->c_numshootdown; i++) {
+				vm_tlbshootdown(&curcpu->c_shootdown[i]);
+			}
 		}
 		curcpu->c_numshootdown = 0;
+		curcpu->c_shootdown_done = curcpu->c_shootdown_sent;
+		wchan_wakeall(curcpu->c_shootdown_wchan, &curcpu->c_ipi_lock);
 	}
 
 	curcpu->c_ipi_pending = 0;
@@ -52,6 +52,8 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	spinlock_init(&vn->vn_countlock);
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
+	vn->vn_cachegen = 0;
+	vn->vn_cachepages = 0;
 	return 0;
 }
 
@@ -62,6 +64,7 @@ void
 vnode_cleanup(struct vnode *vn)
 {
 	KASSERT(vn->vn_refcount == 1);
+	KASSERT(vn->vn_cachepages == 0);
 
 	spinlock_cleanup(&vn->vn_countlock);
 
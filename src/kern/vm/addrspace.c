@@ -29,10 +29,18 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
+#include <kern/stat.h>
 #include <lib.h>
+#include <spinlock.h>
 #include <addrspace.h>
 #include <vm.h>
 #include <proc.h>
+#include <vnode.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <vmtlb.h>
+#include <swap.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -40,6 +48,13 @@
  * used. The cheesy hack versions in dumbvm.c are used instead.
  */
 
+/*
+ * User stack size. Stack pages are only allocated when touched, so
+ * this can be generous. (It must be > 64K so argument blocks of size
+ * ARG_MAX will fit.)
+ */
+#define VM_STACKPAGES    256
+
 struct addrspace *
 as_create(void)
 {
@@ -50,40 +65,278 @@ as_create(void)
 		return NULL;
 	}
 
-	/*
-	 * Initialize as needed.
-	 */
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	as->as_regions = NULL;
+	as->as_heap = NULL;
+	spinlock_init(&as->as_lock);
+	as->as_loading = false;
+	as->as_nlocked = 0;
+	as->as_asid = 0;
+	as->as_cpus = 0;
 
 	return as;
 }
 
+/*
+ * Add the region [BASE, TOP) to AS, keeping the list sorted, and
+ * return it in RET if that isn't NULL. Fails with EINVAL if it
+ * overlaps an existing region. The region may be empty (the heap
+ * starts out that way).
+ */
+static
+int
+as_addregion(struct addrspace *as, vaddr_t base, vaddr_t top, unsigned flags,
+	     struct region **ret)
+{
+	struct region *rg, **pp;
+
+	KASSERT((base & PAGE_FRAME) == base);
+	KASSERT((top & PAGE_FRAME) == top);
+	KASSERT(base <= top);
+
+	for (pp = &as->as_regions; *pp != NULL; pp = &(*pp)->rg_next) {
+		if ((*pp)->rg_base >= top) {
+			break;
+		}
+		if ((*pp)->rg_top > base) {
+			return EINVAL;
+		}
+	}
+
+	rg = kmalloc(sizeof(*rg));
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_base = base;
+	rg->rg_top = top;
+	rg->rg_flags = flags;
+	rg->rg_advice = MADV_NORMAL;
+	rg->rg_vnode = NULL;
+	rg->rg_offset = 0;
+	rg->rg_fileva = 0;
+	rg->rg_filesize = 0;
+	rg->rg_next = *pp;
+	*pp = rg;
+	if (ret != NULL) {
+		*ret = rg;
+	}
+	return 0;
+}
+
+struct region *
+as_findregion(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (vaddr < rg->rg_base) {
+			return NULL;
+		}
+		if (vaddr < rg->rg_top) {
+			return rg;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Release all pages and swap slots in [START, END) and clear their
+ * page table entries. Does not touch the TLB; the caller flushes it if
+ * the address space may be active.
+ */
+static
+void
+as_freerange(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	vaddr_t va;
+	pte_t *pte, oldpte;
+
+	for (va = start; va < end; va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL) {
+			/* No second-level table; skip to the next one. */
+			va = ((va >> PT_L1SHIFT) + 1) << PT_L1SHIFT;
+			if (va == 0 || va >= end) {
+				break;
+			}
+			va -= PAGE_SIZE;
+			continue;
+		}
+		spinlock_acquire(&as->as_lock);
+		while (*pte & PTE_BUSY) {
+			/* Let the pageout finish first. */
+			oldpte = *pte;
+			spinlock_release(&as->as_lock);
+			coremap_waitbusy(oldpte & PTE_FRAME);
+			spinlock_acquire(&as->as_lock);
+		}
+		oldpte = *pte;
+		*pte = 0;
+		if (oldpte & PTE_LOCKED) {
+			KASSERT(as->as_nlocked > 0);
+			as->as_nlocked--;
+		}
+		spinlock_release(&as->as_lock);
+
+		if (oldpte & PTE_LOCKED) {
+			coremap_unlockpage();
+		}
+		if (oldpte & PTE_RESIDENT) {
+			coremap_unmap(oldpte & PTE_FRAME, as, va);
+		}
+		else if (oldpte & PTE_SWAPPED) {
+			swap_free(PTE_SLOT(oldpte));
+		}
+	}
+}
+
+/*
+ * Copy an address space for fork. Nothing is copied: resident pages
+ * are shared between the two address spaces and write access to them
+ * is removed on both sides. The first write by either one faults
+ * (VM_FAULT_READONLY) and vm_fault gives the writer its own copy.
+ * Pages out on swap share the swap slot.
+ *
+ * The coremap is told who maps each shared page, so that whichever
+ * side keeps it after the other lets go becomes its owner again and
+ * it can be paged out. The entries for that are allocated up front,
+ * since they can't be while as_lock is held.
+ */
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *newas;
+	struct region *rg, *newrg;
+	struct coremap_mapper *spare[COREMAP_MAPPERS_NEEDED];
+	vaddr_t va;
+	pte_t *oldpte, *newpte;
+	paddr_t pa;
+	unsigned i;
+	int result;
 
 	newas = as_create();
 	if (newas==NULL) {
 		return ENOMEM;
 	}
+	for (i=0; i<COREMAP_MAPPERS_NEEDED; i++) {
+		spare[i] = NULL;
+	}
 
-	/*
-	 * Write this.
-	 */
+	for (rg = old->as_regions; rg != NULL; rg = rg->rg_next) {
+		result = as_addregion(newas, rg->rg_base, rg->rg_top,
+				      rg->rg_flags, &newrg);
+		if (result) {
+			as_destroy(newas);
+			return result;
+		}
+		if (rg == old->as_heap) {
+			newas->as_heap = newrg;
+		}
+		newrg->rg_advice = rg->rg_advice;
+		if (rg->rg_vnode != NULL) {
+			/* Not as_define_file; rg_fileva may be below rg_base. */
+			VOP_INCREF(rg->rg_vnode);
+			newrg->rg_vnode = rg->rg_vnode;
+			newrg->rg_offset = rg->rg_offset;
+			newrg->rg_fileva = rg->rg_fileva;
+			newrg->rg_filesize = rg->rg_filesize;
+		}
+	}
+
+	for (rg = old->as_regions; rg != NULL; rg = rg->rg_next) {
+		for (va = rg->rg_base; va < rg->rg_top; va += PAGE_SIZE) {
+			oldpte = pt_lookup(old->as_pt, va, false);
+			if (oldpte == NULL) {
+				/* Skip the rest of this second-level span. */
+				va |= (1 << PT_L1SHIFT) - PAGE_SIZE;
+				continue;
+			}
+			if (*oldpte == 0) {
+				continue;
+			}
+			newpte = pt_lookup(newas->as_pt, va, true);
+			if (newpte == NULL) {
+				goto nomem;
+			}
+			for (i=0; i<COREMAP_MAPPERS_NEEDED; i++) {
+				if (spare[i] == NULL) {
+					spare[i] = coremap_mapper_create();
+					if (spare[i] == NULL) {
+						goto nomem;
+					}
+				}
+			}
 
-	(void)old;
+			spinlock_acquire(&old->as_lock);
+			while (*oldpte & PTE_BUSY) {
+				pa = *oldpte & PTE_FRAME;
+				spinlock_release(&old->as_lock);
+				coremap_waitbusy(pa);
+				spinlock_acquire(&old->as_lock);
+			}
+			if (*oldpte & PTE_RESIDENT) {
+				*oldpte &= ~PTE_DIRTY;
+				coremap_sharemap(*oldpte & PTE_FRAME, newas, va,
+						 spare);
+			}
+			else if (*oldpte & PTE_SWAPPED) {
+				swap_share(PTE_SLOT(*oldpte));
+			}
+			/* Locks aren't inherited. */
+			*newpte = *oldpte & ~PTE_LOCKED;
+			spinlock_release(&old->as_lock);
+		}
+	}
+
+	newas->as_loading = old->as_loading;
+
+	/* Drop the old address space's writable entries. */
+	vmtlb_unmapall(old);
+
+	for (i=0; i<COREMAP_MAPPERS_NEEDED; i++) {
+		if (spare[i] != NULL) {
+			coremap_mapper_destroy(spare[i]);
+		}
+	}
 
 	*ret = newas;
 	return 0;
+
+ nomem:
+	for (i=0; i<COREMAP_MAPPERS_NEEDED; i++) {
+		if (spare[i] != NULL) {
+			coremap_mapper_destroy(spare[i]);
+		}
+	}
+	as_destroy(newas);
+	vmtlb_unmapall(old);
+	return ENOMEM;
 }
 
 void
 as_destroy(struct addrspace *as)
 {
-	/*
-	 * Clean up as needed.
-	 */
+	struct region *rg;
 
+	/* No CPU may refer to it any more. */
+	vmtlb_forget(as);
+
+	while (as->as_regions != NULL) {
+		rg = as->as_regions;
+		as->as_regions = rg->rg_next;
+		as_freerange(as, rg->rg_base, rg->rg_top);
+		if (rg->rg_vnode != NULL) {
+			VOP_DECREF(rg->rg_vnode);
+		}
+		kfree(rg);
+	}
+	KASSERT(as->as_nlocked == 0);
+	pt_destroy(as->as_pt);
+	spinlock_cleanup(&as->as_lock);
 	kfree(as);
 }
 
@@ -101,19 +354,15 @@ as_activate(void)
 		return;
 	}
 
-	/*
-	 * Write this.
-	 */
+	/* Entries are tagged with the ASID; no need to flush. */
+	vmtlb_activate(as);
 }
 
 void
 as_deactivate(void)
 {
-	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
-	 */
+	/* Stop using the old address space's ASID and page table. */
+	vmtlb_deactivate();
 }
 
 /*
@@ -122,57 +371,124 @@ as_deactivate(void)
  * VADDR+MEMSIZE.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment. The
+ * hardware cannot distinguish read from execute, so only WRITEABLE
+ * is actually enforced.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 		 int readable, int writeable, int executable)
 {
-	/*
-	 * Write this.
-	 */
+	unsigned flags;
+
+	/* Align the region. First, the base... */
+	memsize += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	memsize = ROUNDUP(memsize, PAGE_SIZE);
+
+	if (memsize == 0) {
+		return 0;
+	}
+	if (vaddr >= USERSPACETOP || memsize > USERSPACETOP - vaddr) {
+		return EFAULT;
+	}
+
+	flags = 0;
+	if (readable) {
+		flags |= RG_READ;
+	}
+	if (writeable) {
+		flags |= RG_WRITE;
+	}
+	if (executable) {
+		flags |= RG_EXEC;
+	}
+
+	return as_addregion(as, vaddr, vaddr + memsize, flags, NULL);
+}
+
+int
+as_define_file(struct addrspace *as, vaddr_t vaddr, size_t filesize,
+	       struct vnode *v, off_t offset)
+{
+	struct region *rg;
+
+	rg = as_findregion(as, vaddr);
+	if (rg == NULL || rg->rg_vnode != NULL ||
+	    filesize > rg->rg_top - vaddr) {
+		return EINVAL;
+	}
 
-	(void)as;
-	(void)vaddr;
-	(void)memsize;
-	(void)readable;
-	(void)writeable;
-	(void)executable;
-	return ENOSYS;
+	VOP_INCREF(v);
+	rg->rg_vnode = v;
+	rg->rg_offset = offset;
+	rg->rg_fileva = vaddr;
+	rg->rg_filesize = filesize;
+	return 0;
 }
 
 int
 as_prepare_load(struct addrspace *as)
 {
 	/*
-	 * Write this.
+	 * load_elf normally just attaches the file to each region with
+	 * as_define_file, but anything it does write through the user
+	 * mapping should ignore write protection until it's done.
 	 */
-
-	(void)as;
+	as->as_loading = true;
 	return 0;
 }
 
 int
 as_complete_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
+	struct region *rg;
+	vaddr_t va;
+	pte_t *pte;
+
+	as->as_loading = false;
+
+	/* Take away write access to pages loaded into read-only regions. */
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg->rg_flags & RG_WRITE) {
+			continue;
+		}
+		for (va = rg->rg_base; va < rg->rg_top; va += PAGE_SIZE) {
+			pte = pt_lookup(as->as_pt, va, false);
+			if (pte != NULL) {
+				spinlock_acquire(&as->as_lock);
+				*pte &= ~PTE_DIRTY;
+				spinlock_release(&as->as_lock);
+			}
+		}
+	}
+
+	vmtlb_unmapall(as);
 
-	(void)as;
+	/* The heap starts out empty, right after the last segment. */
+	if (as->as_regions != NULL && as->as_heap == NULL) {
+		for (rg = as->as_regions; rg->rg_next != NULL;
+		     rg = rg->rg_next) {
+			/* nothing */
+		}
+		return as_addregion(as, rg->rg_top, rg->rg_top,
+				    RG_READ | RG_WRITE, &as->as_heap);
+	}
 	return 0;
 }
 
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	/*
-	 * Write this.
-	 */
+	int result;
 
-	(void)as;
+	result = as_addregion(as, USERSTACK - VM_STACKPAGES * PAGE_SIZE,
+			      USERSTACK, RG_READ | RG_WRITE, NULL);
+	if (result) {
+		return result;
+	}
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
@@ -180,3 +496,396 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+/*
+ * Move the end of the heap by AMOUNT, which must keep it page-aligned,
+ * and return the old end in OLDBREAK. Growing just moves the end;
+ * pages are allocated as they are touched. Shrinking releases the
+ * pages (and swap slots) right away.
+ */
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	struct region *heap;
+	vaddr_t oldtop, newtop, limit;
+	size_t delta;
+
+	heap = as->as_heap;
+	if (heap == NULL) {
+		return ENOMEM;
+	}
+	if (amount % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+
+	oldtop = heap->rg_top;
+	if (amount >= 0) {
+		delta = amount;
+		limit = heap->rg_next != NULL ?
+			heap->rg_next->rg_base : USERSPACETOP;
+		if (delta > limit - oldtop) {
+			return ENOMEM;
+		}
+		heap->rg_top = oldtop + delta;
+	}
+	else {
+		delta = (size_t)0 - (size_t)amount;
+		if (delta > oldtop - heap->rg_base) {
+			return EINVAL;
+		}
+		newtop = oldtop - delta;
+		heap->rg_top = newtop;
+		vmtlb_unmap(as, newtop, delta / PAGE_SIZE);
+		as_freerange(as, newtop, oldtop);
+	}
+
+	*oldbreak = oldtop;
+	return 0;
+}
+
+/*
+ * Find the highest free, page-aligned range of LEN bytes, above page
+ * 0. Placing mappings high keeps them out of the way of the heap.
+ */
+static
+int
+as_findgap(struct addrspace *as, size_t len, vaddr_t *ret)
+{
+	struct region *rg;
+	vaddr_t lo, hi;
+	bool found;
+
+	found = false;
+	lo = PAGE_SIZE;
+	rg = as->as_regions;
+	while (1) {
+		hi = rg != NULL ? rg->rg_base : USERSPACETOP;
+		if (hi > lo && hi - lo >= len) {
+			*ret = hi - len;
+			found = true;
+		}
+		if (rg == NULL) {
+			break;
+		}
+		if (rg->rg_top > lo) {
+			lo = rg->rg_top;
+		}
+		rg = rg->rg_next;
+	}
+	return found ? 0 : ENOMEM;
+}
+
+/*
+ * Map LEN bytes of V starting at OFFSET, or anonymous zeros if V is
+ * NULL. The file is read through the page cache when touched, so a
+ * private mapping shares pages with everyone else mapping or reading
+ * the file until it writes them. Writable shared file mappings would
+ * need dirty pages written back and are not supported; shared
+ * mappings are otherwise the same as private ones (and are not
+ * shared with the child after fork).
+ */
+int
+as_mmap(struct addrspace *as, vaddr_t addr, size_t len, int prot, int flags,
+	struct vnode *v, off_t offset, vaddr_t *ret)
+{
+	struct region *rg;
+	struct stat st;
+	unsigned rgflags;
+	size_t filesize;
+	int result;
+
+	switch (flags & (MAP_SHARED | MAP_PRIVATE)) {
+	    case MAP_SHARED:
+		if (prot & PROT_WRITE) {
+			return ENOSYS;
+		}
+		break;
+	    case MAP_PRIVATE:
+		break;
+	    default:
+		return EINVAL;
+	}
+	if (len == 0 || offset < 0 || offset % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	if (len > USERSPACETOP - PAGE_SIZE) {
+		return ENOMEM;
+	}
+	len = ROUNDUP(len, PAGE_SIZE);
+
+	filesize = 0;
+	if (v != NULL) {
+		result = VOP_MMAP(v);
+		if (result) {
+			return result;
+		}
+		result = VOP_STAT(v, &st);
+		if (result) {
+			return result;
+		}
+		if (offset < st.st_size) {
+			filesize = st.st_size - offset < (off_t)len ?
+				st.st_size - offset : len;
+		}
+	}
+
+	if (flags & MAP_FIXED) {
+		if ((addr & PAGE_FRAME) != addr || addr == 0 ||
+		    addr >= USERSPACETOP || len > USERSPACETOP - addr) {
+			return EINVAL;
+		}
+	}
+	else {
+		result = as_findgap(as, len, &addr);
+		if (result) {
+			return result;
+		}
+	}
+
+	rgflags = RG_MMAP;
+	if (prot & PROT_READ) {
+		rgflags |= RG_READ;
+	}
+	if (prot & PROT_WRITE) {
+		rgflags |= RG_WRITE;
+	}
+	if (prot & PROT_EXEC) {
+		rgflags |= RG_EXEC;
+	}
+
+	/* Fails if a MAP_FIXED address overlaps anything. */
+	result = as_addregion(as, addr, addr + len, rgflags, &rg);
+	if (result) {
+		return result;
+	}
+	if (filesize > 0) {
+		VOP_INCREF(v);
+		rg->rg_vnode = v;
+		rg->rg_offset = offset;
+		rg->rg_fileva = addr;
+		rg->rg_filesize = filesize;
+	}
+
+	*ret = addr;
+	return 0;
+}
+
+/*
+ * Unmap [ADDR, ADDR+LEN). Every region overlapping the range must
+ * have come from as_mmap; parts of mappings outside the range stay
+ * mapped, which may mean splitting one in two.
+ */
+int
+as_munmap(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	struct region *rg, *newrg, **pp;
+	vaddr_t top;
+
+	if ((addr & PAGE_FRAME) != addr || len == 0 ||
+	    addr >= USERSPACETOP || len > USERSPACETOP - addr) {
+		return EINVAL;
+	}
+	top = ROUNDUP(addr + len, PAGE_SIZE);
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg->rg_base < top && rg->rg_top > addr &&
+		    (rg->rg_flags & RG_MMAP) == 0) {
+			return EINVAL;
+		}
+	}
+
+	pp = &as->as_regions;
+	while ((rg = *pp) != NULL && rg->rg_base < top) {
+		if (rg->rg_top <= addr) {
+			pp = &rg->rg_next;
+			continue;
+		}
+		if (rg->rg_base >= addr && rg->rg_top <= top) {
+			/* All of it. */
+			*pp = rg->rg_next;
+			if (rg->rg_vnode != NULL) {
+				VOP_DECREF(rg->rg_vnode);
+			}
+			kfree(rg);
+			continue;
+		}
+		if (rg->rg_base >= addr) {
+			/* The front. */
+			rg->rg_base = top;
+		}
+		else if (rg->rg_top <= top) {
+			/* The back. */
+			rg->rg_top = addr;
+		}
+		else {
+			/*
+			 * The middle. The range is inside this region, so
+			 * nothing has been changed yet if this fails.
+			 */
+			newrg = kmalloc(sizeof(*newrg));
+			if (newrg == NULL) {
+				return ENOMEM;
+			}
+			*newrg = *rg;
+			newrg->rg_base = top;
+			if (newrg->rg_vnode != NULL) {
+				VOP_INCREF(newrg->rg_vnode);
+			}
+			rg->rg_top = addr;
+			rg->rg_next = newrg;
+		}
+		pp = &rg->rg_next;
+	}
+
+	vmtlb_unmap(as, addr, (top - addr) / PAGE_SIZE);
+	as_freerange(as, addr, top);
+	return 0;
+}
+
+/*
+ * Check that [ADDR, ADDR+LEN) is page-aligned at the start and lies
+ * entirely within regions, and return its page-aligned end in TOP.
+ */
+static
+int
+as_checkrange(struct addrspace *as, vaddr_t addr, size_t len, vaddr_t *top)
+{
+	struct region *rg;
+	vaddr_t va;
+
+	if ((addr & PAGE_FRAME) != addr || addr >= USERSPACETOP ||
+	    len > USERSPACETOP - addr) {
+		return EINVAL;
+	}
+	*top = ROUNDUP(addr + len, PAGE_SIZE);
+
+	va = addr;
+	for (rg = as->as_regions; rg != NULL && va < *top; rg = rg->rg_next) {
+		if (rg->rg_top <= va) {
+			continue;
+		}
+		if (rg->rg_base > va) {
+			break;
+		}
+		va = rg->rg_top;
+	}
+	return va < *top ? ENOMEM : 0;
+}
+
+/*
+ * Access pattern advice is kept per region and applies to the whole
+ * of every region the range touches; regions aren't split for it.
+ * MADV_WILLNEED reads in whatever is on swap or in the file now, and
+ * MADV_DONTNEED throws the pages away, so they come back zero (or
+ * from the file) when touched again.
+ */
+int
+as_madvise(struct addrspace *as, vaddr_t addr, size_t len, int advice)
+{
+	struct region *rg;
+	vaddr_t top, va, start, end;
+	pte_t *pte;
+	int result;
+
+	result = as_checkrange(as, addr, len, &top);
+	if (result) {
+		return result;
+	}
+
+	switch (advice) {
+	    case MADV_NORMAL:
+	    case MADV_RANDOM:
+	    case MADV_SEQUENTIAL:
+		for (rg = as->as_regions; rg != NULL && rg->rg_base < top;
+		     rg = rg->rg_next) {
+			if (rg->rg_top > addr) {
+				rg->rg_advice = advice;
+			}
+		}
+		return 0;
+
+	    case MADV_WILLNEED:
+		for (rg = as->as_regions; rg != NULL && rg->rg_base < top;
+		     rg = rg->rg_next) {
+			if ((rg->rg_flags & (RG_READ|RG_WRITE|RG_EXEC)) == 0) {
+				continue;
+			}
+			start = rg->rg_base > addr ? rg->rg_base : addr;
+			end = rg->rg_top < top ? rg->rg_top : top;
+			for (va = start; va < end; va += PAGE_SIZE) {
+				vm_prefetch(as, rg, va);
+			}
+		}
+		return 0;
+
+	    case MADV_DONTNEED:
+		/* Locked pages must be unlocked first. */
+		for (va = addr; va < top; va += PAGE_SIZE) {
+			pte = pt_lookup(as->as_pt, va, false);
+			if (pte != NULL && (*pte & PTE_LOCKED)) {
+				return EINVAL;
+			}
+		}
+		vmtlb_unmap(as, addr, (top - addr) / PAGE_SIZE);
+		as_freerange(as, addr, top);
+		return 0;
+	}
+	return EINVAL;
+}
+
+int
+as_mincore(struct addrspace *as, vaddr_t addr, unsigned npages,
+	   unsigned char *vec)
+{
+	vaddr_t top;
+	pte_t *pte;
+	unsigned i;
+	int result;
+
+	if (npages > (USERSPACETOP - addr) / PAGE_SIZE) {
+		return ENOMEM;
+	}
+	result = as_checkrange(as, addr, npages * PAGE_SIZE, &top);
+	if (result) {
+		return result;
+	}
+
+	for (i = 0; i < npages; i++) {
+		pte = pt_lookup(as->as_pt, addr + i * PAGE_SIZE, false);
+		vec[i] = (pte != NULL && (*pte & PTE_RESIDENT)) ?
+			MINCORE_INCORE : 0;
+	}
+	return 0;
+}
+
+/*
+ * Pages in PROT_NONE regions can't be made resident and are skipped.
+ * If locking fails partway, the pages already done stay locked.
+ */
+int
+as_mlock(struct addrspace *as, vaddr_t addr, size_t len, bool lock)
+{
+	struct region *rg;
+	vaddr_t top, va, start, end;
+	int result;
+
+	result = as_checkrange(as, addr, len, &top);
+	if (result) {
+		return result;
+	}
+
+	for (rg = as->as_regions; rg != NULL && rg->rg_base < top;
+	     rg = rg->rg_next) {
+		if (lock && (rg->rg_flags & (RG_READ|RG_WRITE|RG_EXEC)) == 0) {
+			continue;
+		}
+		start = rg->rg_base > addr ? rg->rg_base : addr;
+		end = rg->rg_top < top ? rg->rg_top : top;
+		for (va = start; va < end; va += PAGE_SIZE) {
+			result = vm_lockpage(as, rg, va, lock);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	return 0;
+}
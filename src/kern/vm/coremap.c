@@ -0,0 +1,1214 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Coremap: the physical page allocator.
+ *
+ * See coremap.h for the overall design.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <spl.h>
+#include <membar.h>
+#include <wchan.h>
+#include <cpu.h>
+#include <current.h>
+#include <vm.h>
+#include <coremap.h>
+
+/* Null value for free list links. */
+#define NOPAGE ((unsigned)-1)
+
+/* Largest buddy block is 2^COREMAP_MAXORDER pages (16M). */
+#define COREMAP_MAXORDER 12
+
+/* A known mapping of a shared user page; see coremap_sharemap. */
+struct coremap_mapper {
+	struct addrspace *cm_as;
+	vaddr_t cm_va;
+	struct coremap_mapper *cm_next;
+};
+
+/*
+ * One spinlock protects the whole coremap. Nothing done while holding
+ * it takes time proportional to anything but the allocation size and
+ * the number of buddy orders.
+ */
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+
+static struct coremap_entry *coremap;
+static unsigned coremap_npages;		/* pages of RAM (size of coremap) */
+static unsigned coremap_firstpage;	/* first page not fixed at boot */
+static unsigned coremap_freehead[COREMAP_MAXORDER+1]; /* by order */
+static unsigned coremap_nfree;		/* number of pages on free lists */
+static unsigned coremap_nkernel;	/* kernel pages allocated */
+static unsigned coremap_nuser;		/* user pages allocated */
+static unsigned coremap_victim;		/* where pickvictim looks next */
+static bool coremap_ready;
+
+/* Waits for busy pages. */
+static struct wchan *coremap_busywchan;
+
+/* Pageout state; only used once coremap_pageout_start has been called. */
+static bool coremap_pageout;		/* daemon is running */
+static unsigned coremap_lowater;	/* wake the daemon below this */
+static unsigned coremap_hiwater;	/* daemon stops at this */
+static unsigned coremap_reserve;	/* user allocations stop at this */
+static bool coremap_pageout_kick;	/* someone is waiting for memory */
+static bool coremap_pageout_progress;	/* last round freed something */
+static struct wchan *coremap_pageoutwchan; /* the daemon waits here */
+static struct wchan *coremap_freewchan;	/* allocations wait here */
+
+/*
+ * Pages locked with mlock, and the most there may be. Locked pages
+ * can't be paged out, so at least half of memory is kept evictable.
+ */
+static unsigned coremap_nlocked;
+static unsigned coremap_maxlocked;
+
+/* Per-CPU magazine size (0 if memory is too small) and refill batch. */
+static unsigned coremap_magsize;
+static unsigned coremap_magbatch;
+
+/*
+ * Free list manipulation. The block of 2^ORDER pages at PAGE goes on
+ * or comes off the list for ORDER. Only the first page of a free
+ * block is on a list; its cme_npages is the block size, and the other
+ * pages in the block are free with cme_npages 0. Caller holds
+ * coremap_lock.
+ */
+static
+void
+freelist_add(unsigned page, unsigned order)
+{
+	struct coremap_entry *cme = &coremap[page];
+
+	cme->cme_state = CME_FREE;
+	cme->cme_npages = 1U << order;
+	cme->cme_refcount = 0;
+	cme->cme_busy = false;
+	cme->cme_as = NULL;
+	cme->cme_va = 0;
+	cme->cme_mappers = NULL;
+	cme->cme_lastuse = 0;
+	cme->cme_prev = NOPAGE;
+	cme->cme_next = coremap_freehead[order];
+	if (coremap_freehead[order] != NOPAGE) {
+		coremap[coremap_freehead[order]].cme_prev = page;
+	}
+	coremap_freehead[order] = page;
+	coremap_nfree += 1U << order;
+}
+
+static
+void
+freelist_remove(unsigned page, unsigned order)
+{
+	struct coremap_entry *cme = &coremap[page];
+
+	KASSERT(cme->cme_state == CME_FREE);
+	KASSERT(cme->cme_npages == 1U << order);
+	if (cme->cme_prev != NOPAGE) {
+		coremap[cme->cme_prev].cme_next = cme->cme_next;
+	}
+	else {
+		KASSERT(coremap_freehead[order] == page);
+		coremap_freehead[order] = cme->cme_next;
+	}
+	if (cme->cme_next != NOPAGE) {
+		coremap[cme->cme_next].cme_prev = cme->cme_prev;
+	}
+	cme->cme_next = cme->cme_prev = NOPAGE;
+	cme->cme_npages = 0;
+	KASSERT(coremap_nfree >= 1U << order);
+	coremap_nfree -= 1U << order;
+}
+
+/*
+ * Return the smallest order whose blocks hold NPAGES pages.
+ */
+static
+unsigned
+buddy_order(unsigned npages)
+{
+	unsigned order;
+
+	order = 0;
+	while ((1U << order) < npages) {
+		order++;
+	}
+	return order;
+}
+
+/*
+ * Take a block of 2^ORDER pages off the free lists, splitting a
+ * larger block if there is no block that size. The pages are left
+ * marked free; the caller changes their state. Returns NOPAGE if
+ * there is no block big enough. Caller holds coremap_lock.
+ */
+static
+unsigned
+buddy_alloc(unsigned order)
+{
+	unsigned k, page;
+
+	for (k=order; k<=COREMAP_MAXORDER; k++) {
+		if (coremap_freehead[k] != NOPAGE) {
+			break;
+		}
+	}
+	if (k > COREMAP_MAXORDER) {
+		return NOPAGE;
+	}
+
+	page = coremap_freehead[k];
+	freelist_remove(page, k);
+	while (k > order) {
+		/* Keep the lower half; the upper half is its free buddy. */
+		k--;
+		freelist_add(page + (1U << k), k);
+	}
+	return page;
+}
+
+/*
+ * Free the block of 2^ORDER pages at PAGE, which must be aligned to
+ * its size, merging it with its buddy for as long as the buddy is
+ * also entirely free. Caller holds coremap_lock.
+ */
+static
+void
+buddy_free(unsigned page, unsigned order)
+{
+	unsigned buddy, i;
+
+	KASSERT((page & ((1U << order) - 1)) == 0);
+	for (i=page; i<page + (1U << order); i++) {
+		coremap[i].cme_state = CME_FREE;
+		coremap[i].cme_npages = 0;
+	}
+
+	while (order < COREMAP_MAXORDER) {
+		buddy = page ^ (1U << order);
+		if (buddy >= coremap_npages ||
+		    coremap[buddy].cme_state != CME_FREE ||
+		    coremap[buddy].cme_npages != 1U << order) {
+			break;
+		}
+		freelist_remove(buddy, order);
+		if (buddy < page) {
+			page = buddy;
+		}
+		order++;
+	}
+	freelist_add(page, order);
+}
+
+/*
+ * Free NPAGES pages starting at PAGE, which need not be a power of
+ * two or aligned, by splitting the range into the largest aligned
+ * blocks that fit. Caller holds coremap_lock.
+ */
+static
+void
+buddy_freerange(unsigned page, unsigned npages)
+{
+	unsigned order;
+
+	while (npages > 0) {
+		order = 0;
+		while (order < COREMAP_MAXORDER &&
+		       (page & ((2U << order) - 1)) == 0 &&
+		       (2U << order) <= npages) {
+			order++;
+		}
+		buddy_free(page, order);
+		page += 1U << order;
+		npages -= 1U << order;
+	}
+}
+
+/*
+ * Take over physical memory. The coremap itself is allocated with
+ * ram_stealmem, so it ends up below ram_getfirstfree() along with the
+ * kernel and is marked fixed like everything else there.
+ */
+void
+coremap_bootstrap(void)
+{
+	paddr_t lastpaddr, firstpaddr, cmpaddr;
+	size_t cmsize;
+	unsigned i;
+
+	KASSERT(!coremap_ready);
+
+	/* ram_getfirstfree clears lastpaddr, so get the size first. */
+	lastpaddr = ram_getsize();
+	coremap_npages = lastpaddr / PAGE_SIZE;
+
+	cmsize = coremap_npages * sizeof(struct coremap_entry);
+	cmpaddr = ram_stealmem(DIVROUNDUP(cmsize, PAGE_SIZE));
+	if (cmpaddr == 0) {
+		panic("coremap: Cannot allocate coremap\n");
+	}
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(cmpaddr);
+
+	firstpaddr = ram_getfirstfree();
+	KASSERT(firstpaddr % PAGE_SIZE == 0);
+	coremap_firstpage = firstpaddr / PAGE_SIZE;
+	KASSERT(coremap_firstpage < coremap_npages);
+
+	for (i=0; i<coremap_npages; i++) {
+		coremap[i].cme_next = coremap[i].cme_prev = NOPAGE;
+		coremap[i].cme_npages = 1;
+		coremap[i].cme_state = CME_FIXED;
+		coremap[i].cme_refcount = 1;
+		coremap[i].cme_busy = false;
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_va = 0;
+		coremap[i].cme_mappers = NULL;
+		coremap[i].cme_lastuse = 0;
+	}
+
+	for (i=0; i<=COREMAP_MAXORDER; i++) {
+		coremap_freehead[i] = NOPAGE;
+	}
+	coremap_nfree = 0;
+	buddy_freerange(coremap_firstpage,
+			coremap_npages - coremap_firstpage);
+	coremap_nkernel = 0;
+	coremap_nuser = 0;
+	coremap_victim = coremap_firstpage;
+	coremap_nlocked = 0;
+	coremap_maxlocked = (coremap_npages - coremap_firstpage) / 2;
+
+	coremap_magsize = (coremap_npages - coremap_firstpage) / 32;
+	if (coremap_magsize > CPU_PAGEMAG) {
+		coremap_magsize = CPU_PAGEMAG;
+	}
+	coremap_magbatch = (coremap_magsize + 1) / 2;
+
+	spinlock_acquire(&coremap_lock);
+	coremap_ready = true;
+	spinlock_release(&coremap_lock);
+
+	coremap_busywchan = wchan_create("coremap");
+	if (coremap_busywchan == NULL) {
+		panic("coremap: Cannot create wchan\n");
+	}
+
+	kprintf("coremap: %u pages, %u free\n", coremap_npages, coremap_nfree);
+}
+
+bool
+coremap_isready(void)
+{
+	return coremap_ready;
+}
+
+/*
+ * Wake the pageout daemon if we have dropped below the low watermark.
+ * Caller holds coremap_lock.
+ */
+static
+void
+coremap_checkwater(void)
+{
+	if (coremap_pageout && coremap_nfree < coremap_lowater) {
+		wchan_wakeone(coremap_pageoutwchan, &coremap_lock);
+	}
+}
+
+/*
+ * Per-CPU magazines.
+ *
+ * Pages in a magazine are marked CME_CACHED; they are neither on the
+ * free list nor counted in coremap_nfree. Each CPU only touches its
+ * own magazine, and only with interrupts off (holding coremap_lock
+ * counts). Allocations and frees that go through a magazine without
+ * the lock record what they did to the page counts in the struct
+ * cpu; that is folded into coremap_nuser and coremap_nkernel the next
+ * time the CPU takes the lock to refill or drain.
+ *
+ * Magazines are only refilled while the free list is comfortably
+ * above the low watermark, and frees bypass them once it isn't, so
+ * that pages don't sit in magazines while the pageout daemon and
+ * allocations waiting on it are counting free pages.
+ */
+
+/*
+ * Add this CPU's page count changes to the totals. Caller holds
+ * coremap_lock.
+ */
+static
+void
+coremap_magfold(struct cpu *c)
+{
+	coremap_nuser += c->c_pagemag_nuser;
+	coremap_nkernel += c->c_pagemag_nkernel;
+	c->c_pagemag_nuser = 0;
+	c->c_pagemag_nkernel = 0;
+}
+
+/*
+ * True if memory is short enough that freed pages should go straight
+ * back on the free list. Unlocked callers get a hint.
+ */
+static
+bool
+coremap_magbypass(void)
+{
+	return coremap_magsize == 0 ||
+		(coremap_pageout &&
+		 coremap_nfree < coremap_lowater + coremap_magbatch);
+}
+
+/*
+ * Move up to NPAGES pages from this CPU's magazine back to the free
+ * list. Caller holds coremap_lock.
+ */
+static
+void
+coremap_magdrain(unsigned npages)
+{
+	struct cpu *c = curcpu->c_self;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	coremap_magfold(c);
+	while (npages > 0 && c->c_npagemag > 0) {
+		c->c_npagemag--;
+		KASSERT(coremap[c->c_pagemag[c->c_npagemag]].cme_state ==
+			CME_CACHED);
+		buddy_free(c->c_pagemag[c->c_npagemag], 0);
+		npages--;
+	}
+}
+
+/*
+ * Top this CPU's magazine up to a batch from the free list, if there
+ * is plenty free. Caller holds coremap_lock.
+ */
+static
+void
+coremap_magfill(void)
+{
+	struct cpu *c = curcpu->c_self;
+	unsigned page;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	coremap_magfold(c);
+	if (coremap_magbypass() ||
+	    coremap_nfree < coremap_lowater + 2 * coremap_magbatch) {
+		return;
+	}
+	while (c->c_npagemag < coremap_magbatch) {
+		page = buddy_alloc(0);
+		KASSERT(page != NOPAGE);
+		coremap[page].cme_state = CME_CACHED;
+		c->c_pagemag[c->c_npagemag++] = page;
+	}
+}
+
+/*
+ * Put PAGE, which has just been freed and is no longer counted, in
+ * this CPU's magazine. Fails if the magazine is full. Caller has
+ * interrupts off.
+ */
+static
+bool
+coremap_magput(unsigned page)
+{
+	struct cpu *c = curcpu->c_self;
+	struct coremap_entry *cme = &coremap[page];
+
+	if (c->c_npagemag >= coremap_magsize) {
+		return false;
+	}
+	cme->cme_state = CME_CACHED;
+	cme->cme_npages = 0;
+	cme->cme_refcount = 0;
+	cme->cme_busy = false;
+	cme->cme_as = NULL;
+	cme->cme_va = 0;
+	cme->cme_mappers = NULL;
+	cme->cme_lastuse = 0;
+	c->c_pagemag[c->c_npagemag++] = page;
+	return true;
+}
+
+/*
+ * Take a page from this CPU's magazine and give it state STATE, owned
+ * by AS at VA. User pages come back busy. Returns NOPAGE if the
+ * magazine is empty. Does not need coremap_lock.
+ */
+static
+unsigned
+coremap_magget(unsigned state, struct addrspace *as, vaddr_t va)
+{
+	struct cpu *c;
+	struct coremap_entry *cme;
+	unsigned page;
+	int spl;
+
+	spl = splhigh();
+	c = curcpu->c_self;
+	if (c->c_npagemag == 0) {
+		splx(spl);
+		return NOPAGE;
+	}
+	page = c->c_pagemag[--c->c_npagemag];
+	cme = &coremap[page];
+	KASSERT(cme->cme_state == CME_CACHED);
+	cme->cme_npages = 1;
+	cme->cme_refcount = 1;
+	cme->cme_busy = (state == CME_USER);
+	cme->cme_as = as;
+	cme->cme_va = va;
+	/* pickvictim may be looking; it must see the page busy. */
+	membar_store_store();
+	cme->cme_state = state;
+	if (state == CME_USER) {
+		c->c_pagemag_nuser++;
+	}
+	else {
+		c->c_pagemag_nkernel++;
+	}
+	splx(spl);
+	return page;
+}
+
+/*
+ * Add up the pages sitting in magazines and the count changes not yet
+ * folded in. Other CPUs may be changing theirs as we look, so this is
+ * only approximate.
+ */
+static
+void
+coremap_magcounts(unsigned *ncached, unsigned *nuser, unsigned *nkernel)
+{
+	struct cpu *c;
+	unsigned i;
+
+	*ncached = *nuser = *nkernel = 0;
+	for (i=0; (c = cpu_bynumber(i)) != NULL; i++) {
+		*ncached += c->c_npagemag;
+		*nuser += c->c_pagemag_nuser;
+		*nkernel += c->c_pagemag_nkernel;
+	}
+}
+
+/*
+ * Take NPAGES contiguous pages off the free lists and give them state
+ * STATE. Returns the first page or NOPAGE. Caller holds coremap_lock.
+ *
+ * The pages come from the smallest buddy block that holds them; if
+ * NPAGES isn't a power of two, the rest of the block is freed again
+ * right away.
+ */
+static
+unsigned
+coremap_getpages(unsigned npages, unsigned state)
+{
+	unsigned order, page, i;
+
+	order = buddy_order(npages);
+	if (npages > coremap_nfree || order > COREMAP_MAXORDER) {
+		return NOPAGE;
+	}
+
+	page = buddy_alloc(order);
+	if (page == NOPAGE) {
+		return NOPAGE;
+	}
+	buddy_freerange(page + npages, (1U << order) - npages);
+
+	for (i=page; i<page+npages; i++) {
+		KASSERT(coremap[i].cme_state == CME_FREE);
+		coremap[i].cme_state = state;
+		coremap[i].cme_npages = 0;
+	}
+	coremap[page].cme_npages = npages;
+	coremap[page].cme_refcount = 1;
+	if (state == CME_USER) {
+		coremap_nuser += npages;
+	}
+	else {
+		coremap_nkernel += npages;
+	}
+
+	coremap_checkwater();
+	return page;
+}
+
+/*
+ * Allocate NPAGES contiguous pages for the kernel. Never sleeps, and
+ * may use the pages held back from user allocations.
+ *
+ * Single pages come from this CPU's magazine when it has any. If a
+ * multi-page run can't be found, give our magazine back to the free
+ * list (it may be holding the missing piece) and try again.
+ */
+paddr_t
+coremap_alloc(unsigned npages)
+{
+	unsigned page;
+
+	KASSERT(coremap_ready);
+	if (npages == 0) {
+		return 0;
+	}
+
+	if (npages == 1) {
+		page = coremap_magget(CME_KERNEL, NULL, 0);
+		if (page != NOPAGE) {
+			return (paddr_t)page * PAGE_SIZE;
+		}
+	}
+
+	spinlock_acquire(&coremap_lock);
+	page = coremap_getpages(npages, CME_KERNEL);
+	if (page == NOPAGE && npages > 1) {
+		coremap_magdrain(CPU_PAGEMAG);
+		page = coremap_getpages(npages, CME_KERNEL);
+	}
+	else if (page != NOPAGE && npages == 1) {
+		coremap_magfill();
+	}
+	spinlock_release(&coremap_lock);
+
+	if (page == NOPAGE) {
+		return 0;
+	}
+	return (paddr_t)page * PAGE_SIZE;
+}
+
+/*
+ * Allocate a page of user memory for AS at VA. The page is returned
+ * busy; the caller unbusies it once it is mapped.
+ *
+ * If the free count is down to the reserve and the pageout daemon is
+ * running, wait for it. If a round of pageout has been done since we
+ * started waiting and it couldn't free anything, give up (unless a
+ * page has appeared in the meantime).
+ */
+paddr_t
+coremap_alloc_user(struct addrspace *as, vaddr_t va)
+{
+	unsigned page;
+	bool waited = false;
+
+	KASSERT(coremap_ready);
+	KASSERT((va & PAGE_FRAME) == va);
+
+	page = coremap_magget(CME_USER, as, va);
+	if (page != NOPAGE) {
+		return (paddr_t)page * PAGE_SIZE;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	while (coremap_pageout && coremap_nfree <= coremap_reserve) {
+		if (waited && !coremap_pageout_progress) {
+			break;
+		}
+		coremap_pageout_kick = true;
+		wchan_wakeone(coremap_pageoutwchan, &coremap_lock);
+		wchan_sleep(coremap_freewchan, &coremap_lock);
+		waited = true;
+	}
+
+	page = coremap_getpages(1, CME_USER);
+	if (page == NOPAGE) {
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+	coremap[page].cme_busy = true;
+	coremap[page].cme_as = as;
+	coremap[page].cme_va = va;
+	coremap_magfill();
+	spinlock_release(&coremap_lock);
+
+	return (paddr_t)page * PAGE_SIZE;
+}
+
+/*
+ * A reference to a user page is going away. If it belongs to the
+ * mapping of AS at VA (AS is NULL if the caller doesn't say), take
+ * that off the page's mapper list. Then if the one reference left is
+ * a mapping on the list, it becomes the owner. Returns list entries
+ * to be freed once coremap_lock is released. Caller holds
+ * coremap_lock and has already decremented cme_refcount.
+ */
+static
+struct coremap_mapper *
+coremap_dropref(struct coremap_entry *cme, struct addrspace *as, vaddr_t va)
+{
+	struct coremap_mapper **cmp, *cm, *dead;
+
+	dead = NULL;
+	cme->cme_as = NULL;
+	if (as != NULL) {
+		for (cmp = &cme->cme_mappers; *cmp != NULL;
+		     cmp = &(*cmp)->cm_next) {
+			cm = *cmp;
+			if (cm->cm_as == as && cm->cm_va == va) {
+				*cmp = cm->cm_next;
+				cm->cm_next = dead;
+				dead = cm;
+				break;
+			}
+		}
+	}
+	if (cme->cme_refcount == 1 && cme->cme_mappers != NULL) {
+		cm = cme->cme_mappers;
+		KASSERT(cm->cm_next == NULL);
+		cme->cme_mappers = NULL;
+		cme->cme_as = cm->cm_as;
+		cme->cme_va = cm->cm_va;
+		cm->cm_next = dead;
+		dead = cm;
+	}
+	KASSERT(cme->cme_refcount > 0 || cme->cme_mappers == NULL);
+	return dead;
+}
+
+/*
+ * Free a list of mapper entries returned by coremap_dropref.
+ */
+static
+void
+coremap_freemappers(struct coremap_mapper *cm)
+{
+	struct coremap_mapper *next;
+
+	for (; cm != NULL; cm = next) {
+		next = cm->cm_next;
+		kfree(cm);
+	}
+}
+
+/*
+ * Free an allocation previously returned by coremap_alloc or
+ * coremap_alloc_user.
+ *
+ * Pages handed out by ram_stealmem before the coremap existed are
+ * fixed; we don't know how big those allocations were, so freeing
+ * them is silently ignored.
+ *
+ * If the page is busy, wait until it isn't. The pageout daemon may
+ * have picked it and be about to look at its owner's page table.
+ *
+ * Single kernel pages are never shared or busy, so they go straight
+ * into this CPU's magazine if there's room. Single user pages go into
+ * it too, but only after the reference count and busy flag have been
+ * dealt with under the lock.
+ *
+ * AS and VA identify the mapping the reference belongs to, if known.
+ */
+static
+void
+coremap_release(paddr_t pa, struct addrspace *as, vaddr_t va)
+{
+	struct coremap_mapper *dead;
+	unsigned page, npages, oldnfree, i;
+	bool ok;
+	int spl;
+
+	KASSERT(coremap_ready);
+	KASSERT(pa % PAGE_SIZE == 0);
+
+	page = pa / PAGE_SIZE;
+	KASSERT(page < coremap_npages);
+
+	/* The caller owns the page, so its state won't change under us. */
+	if (coremap[page].cme_state == CME_KERNEL &&
+	    coremap[page].cme_npages == 1 && !coremap_magbypass()) {
+		spl = splhigh();
+		ok = coremap_magput(page);
+		if (ok) {
+			curcpu->c_pagemag_nkernel--;
+		}
+		splx(spl);
+		if (ok) {
+			return;
+		}
+	}
+
+	spinlock_acquire(&coremap_lock);
+
+	if (coremap[page].cme_state == CME_FIXED) {
+		spinlock_release(&coremap_lock);
+		return;
+	}
+
+	if ((coremap[page].cme_state != CME_KERNEL &&
+	     coremap[page].cme_state != CME_USER) ||
+	    coremap[page].cme_npages == 0) {
+		panic("coremap_free: 0x%x is not an allocated block\n", pa);
+	}
+
+	while (coremap[page].cme_busy) {
+		wchan_sleep(coremap_busywchan, &coremap_lock);
+	}
+
+	KASSERT(coremap[page].cme_refcount > 0);
+	coremap[page].cme_refcount--;
+	dead = coremap_dropref(&coremap[page], as, va);
+	if (coremap[page].cme_refcount > 0) {
+		spinlock_release(&coremap_lock);
+		coremap_freemappers(dead);
+		return;
+	}
+	KASSERT(dead == NULL);
+
+	/*
+	 * The counts may be transiently low here, since other CPUs'
+	 * magazine allocations haven't been added in, so they can't be
+	 * checked for underflow.
+	 */
+	npages = coremap[page].cme_npages;
+	KASSERT(page + npages <= coremap_npages);
+	if (coremap[page].cme_state == CME_USER) {
+		coremap_nuser -= npages;
+	}
+	else {
+		coremap_nkernel -= npages;
+	}
+
+	oldnfree = coremap_nfree;
+	if (npages == 1 && !coremap_magbypass()) {
+		if (!coremap_magput(page)) {
+			coremap_magdrain(coremap_magbatch);
+			ok = coremap_magput(page);
+			KASSERT(ok);
+		}
+	}
+	else {
+		for (i=page; i<page+npages; i++) {
+			KASSERT(coremap[i].cme_state ==
+				coremap[page].cme_state);
+			KASSERT(i == page || coremap[i].cme_npages == 0);
+		}
+		coremap[page].cme_refcount = 0;
+		coremap[page].cme_busy = false;
+		buddy_freerange(page, npages);
+	}
+
+	if (coremap_pageout && oldnfree <= coremap_reserve &&
+	    coremap_nfree > coremap_reserve) {
+		wchan_wakeall(coremap_freewchan, &coremap_lock);
+	}
+
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_free(paddr_t pa)
+{
+	coremap_release(pa, NULL, 0);
+}
+
+void
+coremap_unmap(paddr_t pa, struct addrspace *as, vaddr_t va)
+{
+	KASSERT(as != NULL);
+	coremap_release(pa, as, va);
+}
+
+/*
+ * Add a reference to the page at PA.
+ */
+void
+coremap_share(paddr_t pa)
+{
+	unsigned page;
+
+	KASSERT(coremap_ready);
+	KASSERT(pa % PAGE_SIZE == 0);
+
+	page = pa / PAGE_SIZE;
+	KASSERT(page < coremap_npages);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[page].cme_state == CME_USER);
+	KASSERT(coremap[page].cme_npages == 1);
+	KASSERT(coremap[page].cme_refcount > 0);
+	coremap[page].cme_refcount++;
+	coremap[page].cme_as = NULL;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Return the number of references to the page at PA. Unless the
+ * caller holds the only one, the answer may be stale by the time it
+ * is used.
+ */
+unsigned
+coremap_refcount(paddr_t pa)
+{
+	unsigned page, ret;
+
+	KASSERT(coremap_ready);
+	KASSERT(pa % PAGE_SIZE == 0);
+
+	page = pa / PAGE_SIZE;
+	KASSERT(page < coremap_npages);
+
+	spinlock_acquire(&coremap_lock);
+	ret = coremap[page].cme_refcount;
+	spinlock_release(&coremap_lock);
+	return ret;
+}
+
+/*
+ * Look up the entry for a user page. Caller holds coremap_lock.
+ */
+static
+struct coremap_entry *
+coremap_userpage(paddr_t pa)
+{
+	unsigned page;
+
+	KASSERT(pa % PAGE_SIZE == 0);
+	page = pa / PAGE_SIZE;
+	KASSERT(page < coremap_npages);
+	KASSERT(coremap[page].cme_state == CME_USER);
+	return &coremap[page];
+}
+
+void
+coremap_setowner(paddr_t pa, struct addrspace *as, vaddr_t va)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_userpage(pa);
+	KASSERT(cme->cme_refcount == 1);
+	KASSERT(cme->cme_mappers == NULL);
+	cme->cme_as = as;
+	cme->cme_va = va;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Share a page mapped at VA with NEWAS. If the page has an
+ * owner (it isn't shared yet), the owner goes on the list along with
+ * NEWAS. Other references to an already shared page (the page cache,
+ * or mappings made before it was shared) aren't known, and the page
+ * can only get an owner back once they're gone.
+ */
+void
+coremap_sharemap(paddr_t pa, struct addrspace *newas, vaddr_t va,
+		 struct coremap_mapper **spare)
+{
+	struct coremap_entry *cme;
+	struct coremap_mapper *cm;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_userpage(pa);
+	KASSERT(cme->cme_npages == 1);
+	KASSERT(cme->cme_refcount > 0);
+	if (cme->cme_as != NULL) {
+		KASSERT(cme->cme_refcount == 1);
+		KASSERT(cme->cme_mappers == NULL);
+		cm = spare[0];
+		spare[0] = NULL;
+		cm->cm_as = cme->cme_as;
+		cm->cm_va = cme->cme_va;
+		cm->cm_next = NULL;
+		cme->cme_mappers = cm;
+		cme->cme_as = NULL;
+	}
+	cm = spare[1];
+	spare[1] = NULL;
+	cm->cm_as = newas;
+	cm->cm_va = va;
+	cm->cm_next = cme->cme_mappers;
+	cme->cme_mappers = cm;
+	cme->cme_refcount++;
+	spinlock_release(&coremap_lock);
+}
+
+struct coremap_mapper *
+coremap_mapper_create(void)
+{
+	return kmalloc(sizeof(struct coremap_mapper));
+}
+
+void
+coremap_mapper_destroy(struct coremap_mapper *cm)
+{
+	kfree(cm);
+}
+
+void
+coremap_unbusy(paddr_t pa)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_userpage(pa);
+	KASSERT(cme->cme_busy);
+	cme->cme_busy = false;
+	wchan_wakeall(coremap_busywchan, &coremap_lock);
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Wait until the page at PA is not busy. The page may have been freed
+ * (or even reallocated) by the time we return; the caller is expected
+ * to go back and look at its page table entry again.
+ */
+void
+coremap_waitbusy(paddr_t pa)
+{
+	unsigned page;
+
+	KASSERT(pa % PAGE_SIZE == 0);
+	page = pa / PAGE_SIZE;
+	KASSERT(page < coremap_npages);
+
+	spinlock_acquire(&coremap_lock);
+	while (coremap[page].cme_busy) {
+		wchan_sleep(coremap_busywchan, &coremap_lock);
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Count a page locked with mlock. Fails if that would put too much of
+ * memory out of the pageout daemon's reach.
+ */
+bool
+coremap_lockpage(void)
+{
+	bool ok;
+
+	spinlock_acquire(&coremap_lock);
+	ok = coremap_nlocked < coremap_maxlocked;
+	if (ok) {
+		coremap_nlocked++;
+	}
+	spinlock_release(&coremap_lock);
+	return ok;
+}
+
+void
+coremap_unlockpage(void)
+{
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap_nlocked > 0);
+	coremap_nlocked--;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Turn on pageout. The watermarks scale with memory size but are
+ * kept small; System/161 configurations often have well under a
+ * megabyte of RAM.
+ */
+void
+coremap_pageout_start(void)
+{
+	unsigned navail;
+
+	KASSERT(coremap_ready);
+	KASSERT(!coremap_pageout);
+
+	coremap_pageoutwchan = wchan_create("pageout");
+	coremap_freewchan = wchan_create("freemem");
+	if (coremap_pageoutwchan == NULL || coremap_freewchan == NULL) {
+		panic("coremap: Cannot create pageout wchans\n");
+	}
+
+	navail = coremap_npages - coremap_firstpage;
+	coremap_lowater = navail / 32;
+	if (coremap_lowater < 4) {
+		coremap_lowater = 4;
+	}
+	coremap_hiwater = coremap_lowater * 2;
+	coremap_reserve = coremap_lowater / 2;
+
+	spinlock_acquire(&coremap_lock);
+	coremap_pageout_progress = true;
+	coremap_pageout = true;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_pageout_wait(void)
+{
+	spinlock_acquire(&coremap_lock);
+	while (coremap_nfree >= coremap_lowater && !coremap_pageout_kick) {
+		wchan_sleep(coremap_pageoutwchan, &coremap_lock);
+	}
+	coremap_pageout_kick = false;
+	spinlock_release(&coremap_lock);
+}
+
+bool
+coremap_pageout_needed(void)
+{
+	/* Unlocked read; this is only advice. */
+	return coremap_nfree < coremap_hiwater;
+}
+
+void
+coremap_pageout_done(bool progress)
+{
+	spinlock_acquire(&coremap_lock);
+	coremap_pageout_progress = progress;
+	wchan_wakeall(coremap_freewchan, &coremap_lock);
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Choose a page to consider for eviction: the next owned, unshared,
+ * non-busy user page after the last one chosen, or after a random
+ * page. The caller decides whether to actually evict it.
+ */
+paddr_t
+coremap_pickvictim(bool userandom, struct addrspace **as, vaddr_t *va)
+{
+	struct coremap_entry *cme;
+	unsigned i, page;
+
+	spinlock_acquire(&coremap_lock);
+	if (userandom) {
+		page = coremap_firstpage +
+			random() % (coremap_npages - coremap_firstpage);
+	}
+	else {
+		page = coremap_victim;
+	}
+	for (i=0; i<coremap_npages; i++) {
+		if (++page >= coremap_npages) {
+			page = coremap_firstpage;
+		}
+		cme = &coremap[page];
+		if (cme->cme_state != CME_USER || cme->cme_busy ||
+		    cme->cme_as == NULL || cme->cme_refcount != 1) {
+			continue;
+		}
+		cme->cme_busy = true;
+		*as = cme->cme_as;
+		*va = cme->cme_va;
+		coremap_victim = page;
+		spinlock_release(&coremap_lock);
+		return (paddr_t)page * PAGE_SIZE;
+	}
+	spinlock_release(&coremap_lock);
+	return 0;
+}
+
+uint32_t
+coremap_age(paddr_t pa, uint32_t now, bool referenced)
+{
+	struct coremap_entry *cme;
+	uint32_t age;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_userpage(pa);
+	if (referenced) {
+		cme->cme_lastuse = now;
+	}
+	age = now - cme->cme_lastuse;
+	spinlock_release(&coremap_lock);
+	return age;
+}
+
+unsigned
+coremap_totalpages(void)
+{
+	return coremap_npages;
+}
+
+unsigned
+coremap_userpages(void)
+{
+	unsigned ncached, nuser, nkernel;
+
+	coremap_magcounts(&ncached, &nuser, &nkernel);
+	return coremap_nuser + nuser;
+}
+
+/*
+ * Print page usage.
+ */
+void
+coremap_printstats(void)
+{
+	unsigned nfree, nkernel, nuser, nlocked, ncached, dnuser, dnkernel;
+	unsigned nblocks[COREMAP_MAXORDER+1];
+	unsigned i, page;
+
+	if (!coremap_ready) {
+		kprintf("coremap: not initialized\n");
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	nfree = coremap_nfree;
+	nkernel = coremap_nkernel;
+	nuser = coremap_nuser;
+	nlocked = coremap_nlocked;
+	coremap_magcounts(&ncached, &dnuser, &dnkernel);
+	for (i=0; i<=COREMAP_MAXORDER; i++) {
+		nblocks[i] = 0;
+		for (page = coremap_freehead[i]; page != NOPAGE;
+		     page = coremap[page].cme_next) {
+			nblocks[i]++;
+		}
+	}
+	spinlock_release(&coremap_lock);
+	nkernel += dnkernel;
+	nuser += dnuser;
+
+	kprintf("coremap: %u pages total\n", coremap_npages);
+	kprintf("    %5u fixed at boot\n", coremap_firstpage);
+	kprintf("    %5u kernel\n", nkernel);
+	kprintf("    %5u user (%u locked, up to %u)\n", nuser, nlocked,
+		coremap_maxlocked);
+	kprintf("    %5u free\n", nfree);
+	kprintf("    %5u cached in per-cpu magazines (up to %u each)\n",
+		ncached, coremap_magsize);
+	kprintf("    free blocks by size (pages):");
+	for (i=0; i<=COREMAP_MAXORDER; i++) {
+		if (nblocks[i] > 0) {
+			kprintf(" %u:%u", 1U << i, nblocks[i]);
+		}
+	}
+	kprintf("\n");
+	if (coremap_pageout) {
+		kprintf("    watermarks %u/%u, reserve %u\n",
+			coremap_lowater, coremap_hiwater, coremap_reserve);
+	}
+}
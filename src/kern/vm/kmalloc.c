@@ -30,7 +30,12 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <spl.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
 #include <vm.h>
+#include <platform/maxcpus.h>
 
 /*
  * Kernel malloc.
@@ -160,10 +165,9 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the heap pages. Most allocations and frees
+ * never get this far; they are handled per-cpu by the magazine layer
+ * (see below) without taking any lock.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
@@ -345,6 +349,48 @@ freepageref(struct pageref *p)
 static struct pageref *sizebases[NSIZES];
 static struct pageref *allbase;
 
+/*
+ * The block type of each heap page plus one (0 for pages that aren't
+ * subpage heap pages), indexed by physical page number, so kfree can
+ * find a block's size without kmalloc_spinlock. Entries are written
+ * with the lock held and can't change while any block on the page is
+ * allocated. Sized for System/161's 16M, like kheaproots.
+ */
+static uint8_t kheap_pagetypes[TOTAL_PAGEREFS];
+
+static
+void
+settype(vaddr_t prpage, int blktype)
+{
+	paddr_t pa = KVADDR_TO_PADDR(prpage);
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(pa / PAGE_SIZE < TOTAL_PAGEREFS);
+	kheap_pagetypes[pa / PAGE_SIZE] = blktype + 1;
+}
+
+/*
+ * Return the block type for the heap page containing ADDR, or -1 if
+ * it isn't on a subpage heap page.
+ */
+static
+int
+gettype(vaddr_t addr)
+{
+	paddr_t pa;
+
+	if (addr < PADDR_TO_KVADDR(0)) {
+		return -1;
+	}
+	pa = KVADDR_TO_PADDR(addr);
+	if (pa / PAGE_SIZE >= TOTAL_PAGEREFS) {
+		return -1;
+	}
+	return (int)kheap_pagetypes[pa / PAGE_SIZE] - 1;
+}
+
+static void kmag_printstats(void);
+
 ////////////////////////////////////////
 
 #ifdef GUARDS
@@ -812,6 +858,8 @@ kheap_printstats(void)
 	}
 
 	spinlock_release(&kmalloc_spinlock);
+
+	kmag_printstats();
 }
 
 ////////////////////////////////////////
@@ -867,18 +915,13 @@ int blocktype(size_t clientsz)
 }
 
 /*
- * Allocate a block of size SZ, where SZ is not large enough to
- * warrant a whole-page allocation.
+ * Get a free block of type BLKTYPE from the heap pages, making a new
+ * page if necessary. Returns NULL if out of memory.
  */
 static
 void *
-subpage_kmalloc(size_t sz
-#ifdef LABELS
-		, vaddr_t label
-#endif
-	)
+subpage_getblock(unsigned blktype)
 {
-	unsigned blktype;	// index into sizes[] that we're using
 	struct pageref *pr;	// pageref for page we're allocating from
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
@@ -887,26 +930,6 @@ subpage_kmalloc(size_t sz
 
 	volatile int i;
 
-#ifdef GUARDS
-	size_t clientsz;
-#endif
-
-#ifdef GUARDS
-	clientsz = sz;
-	sz += GUARD_OVERHEAD;
-#endif
-#ifdef LABELS
-#ifdef GUARDS
-	/* Include the label in what GUARDS considers the client data. */
-	clientsz += LABEL_PTROFFSET;
-#endif
-	sz += LABEL_PTROFFSET;
-#endif
-	blktype = blocktype(sz);
-#ifdef GUARDS
-	sz = sizes[blktype];
-#endif
-
 	spinlock_acquire(&kmalloc_spinlock);
 
 	checksubpages();
@@ -940,12 +963,6 @@ subpage_kmalloc(size_t sz
 				KASSERT(pr->nfree == 0);
 				pr->freelist_offset = INVALID_OFFSET;
 			}
-#ifdef GUARDS
-			retptr = establishguardband(retptr, clientsz, sz);
-#endif
-#ifdef LABELS
-			retptr = establishlabel(retptr, label);
-#endif
 
 			checksubpages();
 
@@ -1013,101 +1030,48 @@ subpage_kmalloc(size_t sz
 	pr->next_all = allbase;
 	allbase = pr;
 
+	settype(prpage, blktype);
+
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
 }
 
 /*
- * Free a pointer previously returned from subpage_kmalloc. If the
- * pointer is not on any heap page we recognize, return -1.
+ * Return a free block of type BLKTYPE at PTRADDR to its heap page,
+ * and release the page if it's now entirely free. The block has
+ * already been checked and deadbeefed.
  */
 static
-int
-subpage_kfree(void *ptr)
+void
+subpage_putblock(vaddr_t ptraddr, unsigned blktype)
 {
-	int blktype;		// index into sizes[] that we're using
-	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
 	struct freelist *fl;	// free list entry
 	vaddr_t offset;		// offset into page
-#ifdef GUARDS
-	size_t blocksize, smallerblocksize;
-#endif
-
-	ptraddr = (vaddr_t)ptr;
-#ifdef GUARDS
-	if (ptraddr % PAGE_SIZE == 0) {
-		/*
-		 * With guard bands, all client-facing subpage
-		 * pointers are offset by GUARD_PTROFFSET (which is 4)
-		 * from the underlying blocks and are therefore not
-		 * page-aligned. So a page-aligned pointer is not one
-		 * of ours. Catch this up front, as otherwise
-		 * subtracting GUARD_PTROFFSET could give a pointer on
-		 * a page we *do* own, and then we'll panic because
-		 * it's not a valid one.
-		 */
-		return -1;
-	}
-	ptraddr -= GUARD_PTROFFSET;
-#endif
-#ifdef LABELS
-	if (ptraddr % PAGE_SIZE == 0) {
-		/* ditto */
-		return -1;
-	}
-	ptraddr -= LABEL_PTROFFSET;
-#endif
 
 	spinlock_acquire(&kmalloc_spinlock);
 
 	checksubpages();
 
-	/* Silence warnings with gcc 4.8 -Og (but not -O2) */
-	prpage = 0;
-	blktype = 0;
-
 	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
-
 		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
+		KASSERT(PR_BLOCKTYPE(pr) < NSIZES);
 		checksubpage(pr);
 
+		prpage = PR_PAGEADDR(pr);
 		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
 			break;
 		}
 	}
 
-	if (pr==NULL) {
-		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
-		return -1;
-	}
-
+	/* The page type table said it was one of ours. */
+	KASSERT(pr != NULL);
+	KASSERT(PR_BLOCKTYPE(pr) == blktype);
+	prpage = PR_PAGEADDR(pr);
 	offset = ptraddr - prpage;
 
-	/* Check for proper positioning and alignment */
-	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
-		panic("kfree: subpage free of invalid addr %p\n", ptr);
-	}
-
-#ifdef GUARDS
-	blocksize = sizes[blktype];
-	smallerblocksize = blktype > 0 ? sizes[blktype - 1] : 0;
-	checkguardband(ptraddr, smallerblocksize, blocksize);
-#endif
-
-	/*
-	 * Clear the block to 0xdeadbeef to make it easier to detect
-	 * uses of dangling pointers.
-	 */
-	fill_deadbeef((void *)ptraddr, sizes[blktype]);
-
 	/*
 	 * We probably ought to check for free twice by seeing if the block
 	 * is already on the free list. But that's expensive, so we don't.
@@ -1142,6 +1106,7 @@ subpage_kfree(void *ptr)
 		/* Whole page is free. */
 		remove_lists(pr, blktype);
 		freepageref(pr);
+		settype(prpage, -1);
 		/* Call free_kpages without kmalloc_spinlock. */
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
@@ -1155,7 +1120,458 @@ subpage_kfree(void *ptr)
 	checksubpages();
 	spinlock_release(&kmalloc_spinlock);
 #endif
+}
+
+////////////////////////////////////////
+//
+// Magazine layer.
+//
+// In front of the heap pages, each CPU keeps two magazines for each
+// block size: small arrays of free blocks, called rounds. kmalloc
+// pops a round off the loaded magazine and kfree pushes one, with
+// interrupts off and no lock at all. When the loaded magazine is
+// empty (for kmalloc) or full (for kfree), it is swapped with the
+// previous one if that helps; otherwise the CPU trades with the
+// depot, which keeps lists of full and empty magazines for each size
+// behind its own spinlock. Only when the depot can't help either do
+// we go to the heap pages under kmalloc_spinlock. This is Bonwick and
+// Adams' magazine layer from the Solaris slab allocator and vmem.
+//
+// Magazines are themselves blocks from the heap pages, taken without
+// going through the magazine layer. The depot holds at most
+// KMAG_DEPOTMAX full and KMAG_DEPOTMAX empty magazines of each size;
+// past that, rounds go back to their pages (and magazines are freed),
+// so heap pages can still be released after a burst of allocation.
+//
+// Blocks in magazines look allocated to the page-level code. With
+// LABELS, which reports allocated blocks as outstanding, or with
+// CHECKGUARDS, which checks guard bands on them, the magazine layer
+// is turned off.
+//
+
+#if defined(LABELS) || defined(CHECKGUARDS)
+#define KMAG_ENABLED 0
+#else
+#define KMAG_ENABLED 1
+#endif
+
+/* Rounds per magazine; this makes a magazine exactly 64 bytes. */
+#define KMAG_ROUNDS 14
+
+/* Most full (or empty) magazines the depot keeps for each size. */
+#define KMAG_DEPOTMAX 4
+
+struct kmag {
+	struct kmag *km_next;		/* on a depot list */
+	unsigned km_rounds;		/* number of blocks in km_objs */
+	void *km_objs[KMAG_ROUNDS];
+};
+
+/* One CPU's magazines for one block size. Only touched by that CPU. */
+struct kmag_cpu {
+	struct kmag *kc_loaded;
+	struct kmag *kc_prev;
+	unsigned kc_rounds;		/* blocks in both, for stats */
+};
+
+struct kmag_depot {
+	struct kmag *kd_full;
+	struct kmag *kd_empty;
+	unsigned kd_nfull;
+	unsigned kd_nempty;
+	unsigned kd_trips;		/* times a CPU came to the depot */
+	unsigned kd_misses;		/* ...and had to go to the pages */
+};
+
+static struct kmag_cpu kmag_cpus[MAXCPUS][NSIZES];
+static struct kmag_depot kmag_depots[NSIZES];
+static struct spinlock kmag_depot_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Take a magazine off a depot list. Caller holds kmag_depot_lock.
+ */
+static
+struct kmag *
+kmag_pop(struct kmag **list, unsigned *count)
+{
+	struct kmag *km;
+
+	km = *list;
+	if (km != NULL) {
+		*list = km->km_next;
+		km->km_next = NULL;
+		KASSERT(*count > 0);
+		(*count)--;
+	}
+	return km;
+}
+
+static
+void
+kmag_push(struct kmag **list, unsigned *count, struct kmag *km)
+{
+	km->km_next = *list;
+	*list = km;
+	(*count)++;
+}
+
+/*
+ * Give the rounds in KM back to the pages, then free KM itself.
+ * Called without any locks held.
+ */
+static
+void
+kmag_destroy(struct kmag *km, unsigned blktype)
+{
+	unsigned i;
+
+	for (i=0; i<km->km_rounds; i++) {
+		subpage_putblock((vaddr_t)km->km_objs[i], blktype);
+	}
+	fill_deadbeef(km, sizeof(*km));
+	subpage_putblock((vaddr_t)km, blocktype(sizeof(*km)));
+}
+
+/*
+ * Get a block of type BLKTYPE from this CPU's magazines or the depot.
+ * Returns NULL if the caller should go to the pages.
+ */
+static
+void *
+kmag_alloc(unsigned blktype)
+{
+	struct kmag_cpu *kc;
+	struct kmag_depot *kd;
+	struct kmag *km, *extra;
+	void *ret;
+	int spl;
+
+	if (!KMAG_ENABLED || !CURCPU_EXISTS()) {
+		return NULL;
+	}
+
+	extra = NULL;
+	spl = splhigh();
+	KASSERT(curcpu->c_number < MAXCPUS);
+	kc = &kmag_cpus[curcpu->c_number][blktype];
+
+	if (kc->kc_loaded == NULL || kc->kc_loaded->km_rounds == 0) {
+		if (kc->kc_prev != NULL && kc->kc_prev->km_rounds > 0) {
+			km = kc->kc_loaded;
+			kc->kc_loaded = kc->kc_prev;
+			kc->kc_prev = km;
+		}
+		else {
+			kd = &kmag_depots[blktype];
+			spinlock_acquire(&kmag_depot_lock);
+			kd->kd_trips++;
+			km = kmag_pop(&kd->kd_full, &kd->kd_nfull);
+			if (km != NULL) {
+				/* prev is empty; it goes back to the depot */
+				if (kc->kc_prev == NULL) {
+					/* nothing */
+				}
+				else if (kd->kd_nempty < KMAG_DEPOTMAX) {
+					kmag_push(&kd->kd_empty,
+						  &kd->kd_nempty, kc->kc_prev);
+				}
+				else {
+					extra = kc->kc_prev;
+				}
+				kc->kc_prev = kc->kc_loaded;
+				kc->kc_loaded = km;
+				kc->kc_rounds += km->km_rounds;
+			}
+			else {
+				kd->kd_misses++;
+			}
+			spinlock_release(&kmag_depot_lock);
+		}
+	}
+
+	ret = NULL;
+	km = kc->kc_loaded;
+	if (km != NULL && km->km_rounds > 0) {
+		ret = km->km_objs[--km->km_rounds];
+		kc->kc_rounds--;
+	}
+	splx(spl);
+
+	if (extra != NULL) {
+		kmag_destroy(extra, blktype);
+	}
+	return ret;
+}
+
+/*
+ * Put the free block at PTRADDR, of type BLKTYPE, in this CPU's
+ * magazines. Returns false if it should go back to its page instead.
+ *
+ * If the depot has no empty magazine to give us, make one, but only
+ * if we're somewhere kmalloc is allowed.
+ */
+static
+bool
+kmag_free(vaddr_t ptraddr, unsigned blktype)
+{
+	struct kmag_cpu *kc;
+	struct kmag_depot *kd;
+	struct kmag *km, *extra;
+	bool done, made;
+	int spl;
+
+	if (!KMAG_ENABLED || !CURCPU_EXISTS()) {
+		return false;
+	}
+
+	kd = &kmag_depots[blktype];
+	made = false;
+	while (1) {
+		extra = NULL;
+
+		spl = splhigh();
+		KASSERT(curcpu->c_number < MAXCPUS);
+		kc = &kmag_cpus[curcpu->c_number][blktype];
+
+		if (kc->kc_loaded == NULL ||
+		    kc->kc_loaded->km_rounds == KMAG_ROUNDS) {
+			if (kc->kc_prev != NULL &&
+			    kc->kc_prev->km_rounds < KMAG_ROUNDS) {
+				km = kc->kc_loaded;
+				kc->kc_loaded = kc->kc_prev;
+				kc->kc_prev = km;
+			}
+			else {
+				spinlock_acquire(&kmag_depot_lock);
+				kd->kd_trips++;
+				km = kmag_pop(&kd->kd_empty, &kd->kd_nempty);
+				if (km != NULL) {
+					/* prev is full; it leaves this CPU */
+					if (kc->kc_prev != NULL) {
+						kc->kc_rounds -=
+							kc->kc_prev->km_rounds;
+					}
+					if (kc->kc_prev == NULL) {
+						/* nothing */
+					}
+					else if (kd->kd_nfull < KMAG_DEPOTMAX) {
+						kmag_push(&kd->kd_full,
+							  &kd->kd_nfull,
+							  kc->kc_prev);
+					}
+					else {
+						extra = kc->kc_prev;
+					}
+					kc->kc_prev = kc->kc_loaded;
+					kc->kc_loaded = km;
+				}
+				else {
+					kd->kd_misses++;
+				}
+				spinlock_release(&kmag_depot_lock);
+			}
+		}
+
+		done = false;
+		km = kc->kc_loaded;
+		if (km != NULL && km->km_rounds < KMAG_ROUNDS) {
+			km->km_objs[km->km_rounds++] = (void *)ptraddr;
+			kc->kc_rounds++;
+			done = true;
+		}
+		splx(spl);
+
+		if (extra != NULL) {
+			kmag_destroy(extra, blktype);
+		}
+		if (done) {
+			return true;
+		}
+		if (made || curcpu->c_spinlocks > 0 ||
+		    curthread->t_in_interrupt) {
+			return false;
+		}
+
+		km = subpage_getblock(blocktype(sizeof(*km)));
+		if (km == NULL) {
+			return false;
+		}
+		km->km_next = NULL;
+		km->km_rounds = 0;
+		spinlock_acquire(&kmag_depot_lock);
+		if (kd->kd_nempty < KMAG_DEPOTMAX) {
+			kmag_push(&kd->kd_empty, &kd->kd_nempty, km);
+			km = NULL;
+		}
+		spinlock_release(&kmag_depot_lock);
+		if (km != NULL) {
+			/* Someone else beat us to it. */
+			kmag_destroy(km, blktype);
+		}
+		made = true;
+	}
+}
+
+/*
+ * Print the magazine layer's counts for each block size.
+ */
+static
+void
+kmag_printstats(void)
+{
+	struct kmag_depot *kd;
+	struct kmag *km;
+	unsigned i, cpu, incpus, indepot;
+
+	if (!KMAG_ENABLED) {
+		return;
+	}
+
+	kprintf("Magazine layer (blocks cached per size):\n");
+	for (i=0; i<NSIZES; i++) {
+		incpus = 0;
+		for (cpu=0; cpu<MAXCPUS; cpu++) {
+			/* Other CPUs' counts may be changing; roughly right. */
+			incpus += kmag_cpus[cpu][i].kc_rounds;
+		}
+		kd = &kmag_depots[i];
+		indepot = 0;
+		spinlock_acquire(&kmag_depot_lock);
+		for (km = kd->kd_full; km != NULL; km = km->km_next) {
+			indepot += km->km_rounds;
+		}
+		kprintf("    size %-4lu  %u in cpus, %u in depot "
+			"(%u full, %u empty mags), %u/%u depot misses\n",
+			(unsigned long)sizes[i], incpus, indepot,
+			kd->kd_nfull, kd->kd_nempty,
+			kd->kd_misses, kd->kd_trips);
+		spinlock_release(&kmag_depot_lock);
+	}
+}
+
+////////////////////////////////////////
+
+/*
+ * Allocate a block of size SZ, where SZ is not large enough to
+ * warrant a whole-page allocation.
+ */
+static
+void *
+subpage_kmalloc(size_t sz
+#ifdef LABELS
+		, vaddr_t label
+#endif
+	)
+{
+	unsigned blktype;	// index into sizes[] that we're using
+	void *retptr;		// our result
+
+#ifdef GUARDS
+	size_t clientsz;
+#endif
+
+#ifdef GUARDS
+	clientsz = sz;
+	sz += GUARD_OVERHEAD;
+#endif
+#ifdef LABELS
+#ifdef GUARDS
+	/* Include the label in what GUARDS considers the client data. */
+	clientsz += LABEL_PTROFFSET;
+#endif
+	sz += LABEL_PTROFFSET;
+#endif
+	blktype = blocktype(sz);
+#ifdef GUARDS
+	sz = sizes[blktype];
+#endif
+
+	retptr = kmag_alloc(blktype);
+	if (retptr == NULL) {
+		retptr = subpage_getblock(blktype);
+		if (retptr == NULL) {
+			return NULL;
+		}
+	}
 
+#ifdef GUARDS
+	retptr = establishguardband(retptr, clientsz, sz);
+#endif
+#ifdef LABELS
+	retptr = establishlabel(retptr, label);
+#endif
+	return retptr;
+}
+
+/*
+ * Free a pointer previously returned from subpage_kmalloc. If the
+ * pointer is not on any heap page we recognize, return -1.
+ */
+static
+int
+subpage_kfree(void *ptr)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t ptraddr;	// same as ptr
+	vaddr_t offset;		// offset into page
+#ifdef GUARDS
+	size_t blocksize, smallerblocksize;
+#endif
+
+	ptraddr = (vaddr_t)ptr;
+#ifdef GUARDS
+	if (ptraddr % PAGE_SIZE == 0) {
+		/*
+		 * With guard bands, all client-facing subpage
+		 * pointers are offset by GUARD_PTROFFSET (which is 4)
+		 * from the underlying blocks and are therefore not
+		 * page-aligned. So a page-aligned pointer is not one
+		 * of ours. Catch this up front, as otherwise
+		 * subtracting GUARD_PTROFFSET could give a pointer on
+		 * a page we *do* own, and then we'll panic because
+		 * it's not a valid one.
+		 */
+		return -1;
+	}
+	ptraddr -= GUARD_PTROFFSET;
+#endif
+#ifdef LABELS
+	if (ptraddr % PAGE_SIZE == 0) {
+		/* ditto */
+		return -1;
+	}
+	ptraddr -= LABEL_PTROFFSET;
+#endif
+
+	blktype = gettype(ptraddr);
+	if (blktype < 0) {
+		/* Not on any of our pages - not a subpage allocation */
+		return -1;
+	}
+	KASSERT(blktype < NSIZES);
+
+	offset = ptraddr % PAGE_SIZE;
+
+	/* Check for proper positioning and alignment */
+	if (offset % sizes[blktype] != 0) {
+		panic("kfree: subpage free of invalid addr %p\n", ptr);
+	}
+
+#ifdef GUARDS
+	blocksize = sizes[blktype];
+	smallerblocksize = blktype > 0 ? sizes[blktype - 1] : 0;
+	checkguardband(ptraddr, smallerblocksize, blocksize);
+#endif
+
+	/*
+	 * Clear the block to 0xdeadbeef to make it easier to detect
+	 * uses of dangling pointers.
+	 */
+	fill_deadbeef((void *)ptraddr, sizes[blktype]);
+
+	if (!kmag_free(ptraddr, blktype)) {
+		subpage_putblock(ptraddr, blktype);
+	}
 	return 0;
 }
 
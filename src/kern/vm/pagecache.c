@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Page cache. See pagecache.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagecache.h>
+
+#define PC_NBUCKETS 64
+
+struct pcentry {
+	struct vnode *pe_vnode;		/* not referenced; see pagecache.h */
+	off_t pe_offset;		/* file offset of first byte read */
+	size_t pe_skip;			/* leading zero bytes */
+	size_t pe_len;			/* bytes from the file */
+	paddr_t pe_paddr;		/* the page */
+	struct pcentry *pe_next;	/* hash chain */
+};
+
+/* Protects everything below. */
+static struct spinlock pagecache_lock = SPINLOCK_INITIALIZER;
+static struct pcentry *pagecache_buckets[PC_NBUCKETS];
+static unsigned pagecache_rotor;	/* where reclaim looks next */
+static unsigned pagecache_npages;
+static unsigned pagecache_nhits;
+static unsigned pagecache_nmisses;
+static unsigned pagecache_nreclaimed;
+
+static
+unsigned
+pagecache_hash(struct vnode *v, off_t offset)
+{
+	return ((uintptr_t)v / sizeof(void *) + offset / PAGE_SIZE)
+		% PC_NBUCKETS;
+}
+
+/*
+ * Look up an entry. Caller holds pagecache_lock.
+ */
+static
+struct pcentry *
+pagecache_find(struct vnode *v, off_t offset, size_t skip, size_t len)
+{
+	struct pcentry *pe;
+
+	for (pe = pagecache_buckets[pagecache_hash(v, offset)];
+	     pe != NULL; pe = pe->pe_next) {
+		if (pe->pe_vnode == v && pe->pe_offset == offset &&
+		    pe->pe_skip == skip && pe->pe_len == len) {
+			return pe;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Read a page's worth of V into the page at PA.
+ */
+static
+int
+pagecache_read(struct vnode *v, off_t offset, size_t skip, size_t len,
+	       paddr_t pa)
+{
+	struct iovec iov;
+	struct uio ku;
+	char *kva;
+	int result;
+
+	kva = (char *)PADDR_TO_KVADDR(pa);
+	bzero(kva, PAGE_SIZE);
+
+	uio_kinit(&iov, &ku, kva + skip, len, offset, UIO_READ);
+	result = VOP_READ(v, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+bool
+pagecache_lookup(struct vnode *v, off_t offset, size_t skip, size_t len,
+		 paddr_t *ret)
+{
+	struct pcentry *pe;
+
+	KASSERT(skip + len <= PAGE_SIZE);
+
+	spinlock_acquire(&pagecache_lock);
+	pe = pagecache_find(v, offset, skip, len);
+	if (pe != NULL) {
+		coremap_share(pe->pe_paddr);
+		pagecache_nhits++;
+		*ret = pe->pe_paddr;
+	}
+	spinlock_release(&pagecache_lock);
+	return pe != NULL;
+}
+
+int
+pagecache_get(struct vnode *v, off_t offset, size_t skip, size_t len,
+	      paddr_t *ret)
+{
+	struct pcentry *pe, *other;
+	unsigned gen;
+	paddr_t pa;
+	int result;
+
+	KASSERT(skip + len <= PAGE_SIZE);
+
+ again:
+	if (pagecache_lookup(v, offset, skip, len, ret)) {
+		return 0;
+	}
+
+	spinlock_acquire(&pagecache_lock);
+	pagecache_nmisses++;
+	gen = v->vn_cachegen;
+	spinlock_release(&pagecache_lock);
+
+	/*
+	 * Read the page in without holding anything. If someone else
+	 * does the same page at the same time, one copy is thrown away.
+	 * If the file is written meanwhile, what we read may be stale;
+	 * the write bumps the vnode's generation and we start over.
+	 */
+	pe = kmalloc(sizeof(*pe));
+	if (pe == NULL) {
+		return ENOMEM;
+	}
+	pa = coremap_alloc_user(NULL, 0);
+	if (pa == 0) {
+		kfree(pe);
+		return ENOMEM;
+	}
+	result = pagecache_read(v, offset, skip, len, pa);
+	coremap_unbusy(pa);
+	if (result) {
+		coremap_free(pa);
+		kfree(pe);
+		return result;
+	}
+
+	spinlock_acquire(&pagecache_lock);
+	if (v->vn_cachegen != gen) {
+		spinlock_release(&pagecache_lock);
+		coremap_free(pa);
+		kfree(pe);
+		goto again;
+	}
+	other = pagecache_find(v, offset, skip, len);
+	if (other != NULL) {
+		coremap_share(other->pe_paddr);
+		*ret = other->pe_paddr;
+		spinlock_release(&pagecache_lock);
+		coremap_free(pa);
+		kfree(pe);
+		return 0;
+	}
+
+	pe->pe_vnode = v;
+	pe->pe_offset = offset;
+	pe->pe_skip = skip;
+	pe->pe_len = len;
+	pe->pe_paddr = pa;
+	pe->pe_next = pagecache_buckets[pagecache_hash(v, offset)];
+	pagecache_buckets[pagecache_hash(v, offset)] = pe;
+	pagecache_npages++;
+	v->vn_cachepages++;
+
+	/* One reference for the cache, one for the caller. */
+	coremap_share(pa);
+	*ret = pa;
+	spinlock_release(&pagecache_lock);
+	return 0;
+}
+
+void
+pagecache_put(paddr_t pa)
+{
+	coremap_free(pa);
+}
+
+/*
+ * Release a list of entries removed from the cache.
+ */
+static
+void
+pagecache_release(struct pcentry *list)
+{
+	struct pcentry *pe;
+
+	while (list != NULL) {
+		pe = list;
+		list = pe->pe_next;
+		coremap_free(pe->pe_paddr);
+		kfree(pe);
+	}
+}
+
+/*
+ * Remove up to MAX entries that nobody maps, starting at the reclaim
+ * rotor.
+ */
+static
+unsigned
+pagecache_remove(unsigned max)
+{
+	struct pcentry *pe, **pp, *list;
+	unsigned i, bucket, n;
+
+	list = NULL;
+	n = 0;
+
+	spinlock_acquire(&pagecache_lock);
+	for (i=0; i<PC_NBUCKETS && n < max; i++) {
+		bucket = pagecache_rotor;
+		pagecache_rotor = (pagecache_rotor + 1) % PC_NBUCKETS;
+
+		pp = &pagecache_buckets[bucket];
+		while (*pp != NULL && n < max) {
+			pe = *pp;
+			if (coremap_refcount(pe->pe_paddr) == 1) {
+				*pp = pe->pe_next;
+				pe->pe_next = list;
+				list = pe;
+				KASSERT(pe->pe_vnode->vn_cachepages > 0);
+				pe->pe_vnode->vn_cachepages--;
+				n++;
+			}
+			else {
+				pp = &pe->pe_next;
+			}
+		}
+	}
+	KASSERT(pagecache_npages >= n);
+	pagecache_npages -= n;
+	pagecache_nreclaimed += n;
+	spinlock_release(&pagecache_lock);
+
+	pagecache_release(list);
+	return n;
+}
+
+unsigned
+pagecache_reclaim(unsigned npages)
+{
+	return pagecache_remove(npages);
+}
+
+/*
+ * Remove V's entries that hold any of the file between START and END,
+ * or all of V's entries if ALL is set, and bump V's generation so a
+ * pagecache_get already reading the old contents won't cache them.
+ *
+ * An entry holds at most a page of the file, so it starts less than a
+ * page before START; only the buckets those offsets hash to need
+ * looking at, unless the range is big enough to cover every bucket.
+ */
+static
+void
+pagecache_drop(struct vnode *v, off_t start, off_t end, bool all)
+{
+	struct pcentry *pe, **pp, *list;
+	off_t first, npages;
+	unsigned i, n;
+	bool take;
+
+	KASSERT(v != NULL);
+
+	if (all) {
+		first = 0;
+		npages = PC_NBUCKETS;
+	}
+	else {
+		KASSERT(start >= 0);
+		if (start >= end) {
+			return;
+		}
+		first = start < PAGE_SIZE ? 0 : (start - PAGE_SIZE + 1) / PAGE_SIZE;
+		npages = (end - 1) / PAGE_SIZE - first + 1;
+		if (npages > PC_NBUCKETS) {
+			npages = PC_NBUCKETS;
+		}
+	}
+
+	list = NULL;
+	n = 0;
+
+	spinlock_acquire(&pagecache_lock);
+	v->vn_cachegen++;
+	for (i=0; i<npages && v->vn_cachepages > 0; i++) {
+		pp = &pagecache_buckets[pagecache_hash(v,
+						       (first + i) * PAGE_SIZE)];
+		while (*pp != NULL) {
+			pe = *pp;
+			take = pe->pe_vnode == v && (all ||
+				(pe->pe_offset < end &&
+				 pe->pe_offset + (off_t)pe->pe_len > start));
+			if (take) {
+				*pp = pe->pe_next;
+				pe->pe_next = list;
+				list = pe;
+				v->vn_cachepages--;
+				n++;
+			}
+			else {
+				pp = &pe->pe_next;
+			}
+		}
+	}
+	KASSERT(!all || v->vn_cachepages == 0);
+	KASSERT(pagecache_npages >= n);
+	pagecache_npages -= n;
+	spinlock_release(&pagecache_lock);
+
+	pagecache_release(list);
+}
+
+void
+pagecache_invalidate(struct vnode *v)
+{
+	pagecache_drop(v, 0, 0, true);
+}
+
+void
+pagecache_invalidate_range(struct vnode *v, off_t start, off_t end)
+{
+	pagecache_drop(v, start, end, false);
+}
+
+void
+pagecache_flush(void)
+{
+	pagecache_remove((unsigned)-1);
+}
+
+void
+pagecache_printstats(void)
+{
+	unsigned npages, nhits, nmisses, nreclaimed;
+
+	spinlock_acquire(&pagecache_lock);
+	npages = pagecache_npages;
+	nhits = pagecache_nhits;
+	nmisses = pagecache_nmisses;
+	nreclaimed = pagecache_nreclaimed;
+	spinlock_release(&pagecache_lock);
+
+	kprintf("pagecache: %u pages\n", npages);
+	kprintf("    %u hits, %u misses, %u reclaimed\n",
+		nhits, nmisses, nreclaimed);
+}
@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Pageout daemon. See pageout.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <clock.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <vmtlb.h>
+#include <swap.h>
+#include <pageout.h>
+#include <pagecache.h>
+
+/*
+ * A round looks at no more than two revolutions' worth of candidates,
+ * plus this many, before giving up.
+ */
+#define PAGEOUT_SLACK 32
+
+/*
+ * Replacement policy. WSClock is the default; FIFO and random are kept
+ * for comparison. Define PAGEOUT_POLICY to pick a different default at
+ * compile time, or use pageout_setpolicy (the "vmpolicy" menu command)
+ * at runtime.
+ */
+#ifndef PAGEOUT_POLICY
+#define PAGEOUT_POLICY PAGEOUT_WSCLOCK
+#endif
+
+/*
+ * WSClock working set window: a page that is unreferenced and hasn't
+ * been seen referenced for this long is outside the working set.
+ */
+#define WSCLOCK_TAU_MS 250
+
+static const char *const pageout_policynames[] = {
+	[PAGEOUT_FIFO] = "fifo",
+	[PAGEOUT_RANDOM] = "random",
+	[PAGEOUT_WSCLOCK] = "wsclock",
+};
+
+static volatile int pageout_policy = PAGEOUT_POLICY;
+
+/* Statistics. Only the daemon updates these. */
+static unsigned pageout_nevicted;
+static unsigned pageout_nrefcleared;
+static unsigned pageout_nskipped;
+static unsigned pageout_nlocked;
+
+/*
+ * Current time in milliseconds, for WSClock ages. Wraps, which is
+ * fine since only differences are used.
+ */
+static
+uint32_t
+pageout_now(void)
+{
+	struct timespec ts;
+
+	gettime(&ts);
+	return (uint32_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Pick the swap slot to ask for for the page at VA, whose entry is
+ * PTE: the one that goes with a neighbor already out on swap, if there
+ * is one, so they can be read back together. The entries for an
+ * aligned cluster of pages are all in the same second-level table.
+ * Called with as_lock held.
+ */
+static
+unsigned
+pageout_wantslot(vaddr_t va, pte_t *pte)
+{
+	unsigned pos, i;
+	pte_t *first;
+
+	pos = (va / PAGE_SIZE) % SWAP_CLUSTER;
+	first = pte - pos;
+	for (i=0; i<SWAP_CLUSTER; i++) {
+		if (i != pos && (first[i] & PTE_SWAPPED) &&
+		    PTE_SLOT(first[i]) % SWAP_CLUSTER == i) {
+			return PTE_SLOT(first[i]) - i + pos;
+		}
+	}
+	return SWAP_NOSLOT;
+}
+
+/*
+ * Consider the busy page PA, mapped at VA in AS, for eviction; if it
+ * is chosen, write it to swap and free it. Otherwise, or on failure,
+ * the page is left resident and unbusied.
+ *
+ * Under WSClock, a referenced page has its reference bit cleared
+ * instead, and an unreferenced one is only evicted if it is older
+ * than the working set window, unless FORCE is set.
+ */
+static
+int
+pageout_evict(paddr_t pa, struct addrspace *as, vaddr_t va, bool force)
+{
+	struct vmtlb_pending vp;
+	pte_t *pte, oldpte;
+	unsigned want, slot;
+	uint32_t age;
+	int result;
+
+	/*
+	 * Make sure the owner still maps the page and hasn't shared it
+	 * with a child since it was picked.
+	 */
+	spinlock_acquire(&as->as_lock);
+	pte = pt_lookup(as->as_pt, va, false);
+	if (pte == NULL ||
+	    (*pte & (PTE_FRAME | PTE_RESIDENT)) != (pa | PTE_RESIDENT) ||
+	    coremap_refcount(pa) != 1) {
+		spinlock_release(&as->as_lock);
+		coremap_unbusy(pa);
+		return EAGAIN;
+	}
+	if (*pte & PTE_LOCKED) {
+		spinlock_release(&as->as_lock);
+		coremap_unbusy(pa);
+		pageout_nlocked++;
+		return EAGAIN;
+	}
+
+	if (pageout_policy == PAGEOUT_WSCLOCK) {
+		if (*pte & PTE_VALID) {
+			/* Referenced: clear the bit and move on. */
+			*pte &= ~PTE_VALID;
+			spinlock_release(&as->as_lock);
+			/*
+			 * No need to wait; a use in the meantime only
+			 * goes unnoticed.
+			 */
+			vmtlb_shootdown_init(&vp);
+			vmtlb_shootdown_add(&vp, as, va, 1);
+			vmtlb_shootdown_send(&vp);
+			coremap_age(pa, pageout_now(), true);
+			coremap_unbusy(pa);
+			pageout_nrefcleared++;
+			return EAGAIN;
+		}
+		age = coremap_age(pa, pageout_now(), false);
+		if (age < WSCLOCK_TAU_MS && !force) {
+			/* Still in the working set. */
+			spinlock_release(&as->as_lock);
+			coremap_unbusy(pa);
+			pageout_nskipped++;
+			return EAGAIN;
+		}
+	}
+
+	/*
+	 * Take the page away. Faults on it will wait until we're done.
+	 */
+	oldpte = *pte;
+	*pte = pa | PTE_BUSY;
+	want = pageout_wantslot(va, pte);
+	spinlock_release(&as->as_lock);
+
+	/* Get other CPUs started on dropping it while we find a slot. */
+	vmtlb_shootdown_init(&vp);
+	vmtlb_shootdown_add(&vp, as, va, 1);
+	vmtlb_shootdown_send(&vp);
+
+	result = swap_alloc(want, (va / PAGE_SIZE) % SWAP_CLUSTER, &slot);
+	if (result) {
+		goto fail;
+	}
+
+	/* Nobody may write the page after this. */
+	vmtlb_shootdown_wait(&vp);
+
+	result = swap_write(slot, pa);
+	if (result) {
+		swap_free(slot);
+		goto fail;
+	}
+
+	spinlock_acquire(&as->as_lock);
+	*pte = PTE_MKSWAP(slot);
+	spinlock_release(&as->as_lock);
+
+	coremap_unbusy(pa);
+	coremap_free(pa);
+	pageout_nevicted++;
+	return 0;
+
+ fail:
+	spinlock_acquire(&as->as_lock);
+	*pte = oldpte;
+	spinlock_release(&as->as_lock);
+	coremap_unbusy(pa);
+	return result;
+}
+
+/* Cached pages to reclaim at a time. */
+#define PAGEOUT_CACHEBATCH 8
+
+/*
+ * Run one round of pageout: free pages until we're back over the high
+ * watermark. First drop cached file pages nobody maps, since that
+ * costs no I/O, then evict to swap. Candidates are examined in clock
+ * order (or at random); after a full revolution without finding an
+ * old enough page, WSClock takes whatever unreferenced page comes
+ * next.
+ */
+static
+bool
+pageout_round(void)
+{
+	struct addrspace *as;
+	vaddr_t va;
+	paddr_t pa;
+	unsigned nscan, maxscan;
+	bool progress, force;
+	int policy;
+
+	policy = pageout_policy;
+	maxscan = 2 * coremap_userpages() + PAGEOUT_SLACK;
+
+	progress = false;
+	while (coremap_pageout_needed() &&
+	       pagecache_reclaim(PAGEOUT_CACHEBATCH) > 0) {
+		progress = true;
+	}
+	if (!swap_enabled()) {
+		return progress || !coremap_pageout_needed();
+	}
+
+	for (nscan = 0; coremap_pageout_needed() && nscan < maxscan; nscan++) {
+		pa = coremap_pickvictim(policy == PAGEOUT_RANDOM, &as, &va);
+		if (pa == 0) {
+			break;
+		}
+		force = nscan >= coremap_userpages();
+		if (pageout_evict(pa, as, va, force) == 0) {
+			progress = true;
+		}
+	}
+	return progress || !coremap_pageout_needed();
+}
+
+static
+void
+pageout_thread(void *data1, unsigned long data2)
+{
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		coremap_pageout_wait();
+		coremap_pageout_done(pageout_round());
+	}
+}
+
+int
+pageout_setpolicy(const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<sizeof(pageout_policynames)/sizeof(pageout_policynames[0]);
+	     i++) {
+		if (!strcmp(name, pageout_policynames[i])) {
+			pageout_policy = i;
+			return 0;
+		}
+	}
+	return EINVAL;
+}
+
+void
+pageout_printstats(void)
+{
+	kprintf("pageout: policy %s", pageout_policynames[pageout_policy]);
+	if (!swap_enabled()) {
+		kprintf(" (no swap)");
+	}
+	kprintf("\n");
+	kprintf("    %u evicted, %u references cleared, %u skipped, "
+		"%u locked\n", pageout_nevicted, pageout_nrefcleared,
+		pageout_nskipped, pageout_nlocked);
+}
+
+void
+pageout_deactivate(struct addrspace *as, vaddr_t va)
+{
+	struct vmtlb_pending vp;
+	pte_t *pte;
+	paddr_t pa;
+
+	pte = pt_lookup(as->as_pt, va, false);
+	if (pte == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&as->as_lock);
+	if ((*pte & (PTE_RESIDENT | PTE_VALID | PTE_LOCKED)) !=
+	    (PTE_RESIDENT | PTE_VALID) ||
+	    coremap_refcount(*pte & PTE_FRAME) != 1) {
+		spinlock_release(&as->as_lock);
+		return;
+	}
+	/* As if the daemon had cleared the bit a window ago. */
+	*pte &= ~PTE_VALID;
+	pa = *pte & PTE_FRAME;
+	coremap_age(pa, pageout_now() - WSCLOCK_TAU_MS, true);
+	spinlock_release(&as->as_lock);
+
+	vmtlb_shootdown_init(&vp);
+	vmtlb_shootdown_add(&vp, as, va, 1);
+	vmtlb_shootdown_send(&vp);
+}
+
+void
+pageout_bootstrap(void)
+{
+	int result;
+
+	coremap_pageout_start();
+
+	result = thread_fork("pageout", NULL, pageout_thread, NULL, 0);
+	if (result) {
+		panic("pageout: thread_fork failed: %s\n", strerror(result));
+	}
+}
@@ -0,0 +1,338 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Swap space. See swap.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <vm.h>
+#include <swap.h>
+#include <zswap.h>
+
+/* Maximum slot reference count. */
+#define SWAP_MAXREF 0xffff
+
+static struct vnode *swap_vnode;
+static unsigned swap_nslots;
+
+/* Protects the bitmap, reference counts, and counters. */
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+static struct bitmap *swap_map;
+static uint16_t *swap_refs;
+static uint8_t *swap_clusterused;	/* slots in use in each cluster */
+static unsigned swap_nclusters;		/* whole clusters */
+static unsigned swap_nextcluster;	/* where to look for an empty one */
+static unsigned swap_nused;
+static unsigned swap_nreads;
+static unsigned swap_nreadreqs;
+static unsigned swap_nwrites;
+static unsigned swap_nclustered;
+
+void
+swap_bootstrap(void)
+{
+	char path[] = "lhd1raw:";
+	struct stat st;
+	int result;
+
+	result = vfs_open(path, O_RDWR, 0, &swap_vnode);
+	if (result) {
+		kprintf("swap: %s: %s; swapping disabled\n", path,
+			strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap: %s: stat: %s\n", path, strerror(result));
+	}
+	swap_nslots = st.st_size / PAGE_SIZE;
+	if (swap_nslots == 0) {
+		kprintf("swap: %s: too small; swapping disabled\n", path);
+		vfs_close(swap_vnode);
+		swap_vnode = NULL;
+		return;
+	}
+
+	swap_nclusters = swap_nslots / SWAP_CLUSTER;
+
+	swap_map = bitmap_create(swap_nslots);
+	swap_refs = kmalloc(swap_nslots * sizeof(swap_refs[0]));
+	swap_clusterused = kmalloc(swap_nclusters + 1);
+	if (swap_map == NULL || swap_refs == NULL ||
+	    swap_clusterused == NULL) {
+		panic("swap: Out of memory\n");
+	}
+	bzero(swap_refs, swap_nslots * sizeof(swap_refs[0]));
+	bzero(swap_clusterused, swap_nclusters + 1);
+
+	zswap_bootstrap(swap_nslots);
+
+	kprintf("swap: %s: %u pages\n", path, swap_nslots);
+}
+
+bool
+swap_enabled(void)
+{
+	return swap_vnode != NULL;
+}
+
+/*
+ * Find a cluster with nothing in it, starting where the last search
+ * left off. Returns SWAP_NOSLOT if there isn't one.
+ */
+static
+unsigned
+swap_findcluster(void)
+{
+	unsigned i, c;
+
+	KASSERT(spinlock_do_i_hold(&swap_lock));
+
+	for (i=0; i<swap_nclusters; i++) {
+		c = (swap_nextcluster + i) % swap_nclusters;
+		if (swap_clusterused[c] == 0) {
+			swap_nextcluster = (c + 1) % swap_nclusters;
+			return c;
+		}
+	}
+	return SWAP_NOSLOT;
+}
+
+int
+swap_alloc(unsigned want, unsigned pos, unsigned *slot)
+{
+	unsigned c;
+	int result;
+
+	KASSERT(pos < SWAP_CLUSTER);
+
+	if (swap_vnode == NULL) {
+		return ENOSPC;
+	}
+
+	spinlock_acquire(&swap_lock);
+	if (want < swap_nslots && !bitmap_isset(swap_map, want)) {
+		*slot = want;
+		bitmap_mark(swap_map, *slot);
+		swap_nclustered++;
+	}
+	else if ((c = swap_findcluster()) != SWAP_NOSLOT) {
+		*slot = c * SWAP_CLUSTER + pos;
+		bitmap_mark(swap_map, *slot);
+	}
+	else {
+		/* Every cluster is partly used; take anything. */
+		result = bitmap_alloc(swap_map, slot);
+		if (result) {
+			spinlock_release(&swap_lock);
+			return result;
+		}
+	}
+	KASSERT(swap_refs[*slot] == 0);
+	swap_refs[*slot] = 1;
+	swap_clusterused[*slot / SWAP_CLUSTER]++;
+	swap_nused++;
+	spinlock_release(&swap_lock);
+	return 0;
+}
+
+void
+swap_share(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(swap_refs[slot] > 0);
+	if (swap_refs[slot] == SWAP_MAXREF) {
+		panic("swap: slot %u: too many references\n", slot);
+	}
+	swap_refs[slot]++;
+	spinlock_release(&swap_lock);
+}
+
+void
+swap_free(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(swap_refs[slot] > 0);
+	if (swap_refs[slot] > 1) {
+		swap_refs[slot]--;
+		spinlock_release(&swap_lock);
+		return;
+	}
+	spinlock_release(&swap_lock);
+
+	/*
+	 * Last reference. Nobody else can get at the slot, so drop any
+	 * compressed copy before the slot can be handed out again.
+	 */
+	zswap_drop(slot);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(swap_refs[slot] == 1);
+	swap_refs[slot] = 0;
+	bitmap_unmark(swap_map, slot);
+	swap_clusterused[slot / SWAP_CLUSTER]--;
+	swap_nused--;
+	spinlock_release(&swap_lock);
+}
+
+/*
+ * Do I/O between the NPAGES slots starting at SLOT and the pages in
+ * PAS, as a single request.
+ */
+static
+int
+swap_io(unsigned slot, const paddr_t *pas, unsigned npages, enum uio_rw rw)
+{
+	struct iovec iov[SWAP_CLUSTER];
+	struct uio ku;
+	unsigned i;
+	int result;
+
+	KASSERT(npages > 0 && npages <= SWAP_CLUSTER);
+	KASSERT(slot < swap_nslots && npages <= swap_nslots - slot);
+
+	for (i=0; i<npages; i++) {
+		KASSERT(pas[i] % PAGE_SIZE == 0);
+		iov[i].iov_kbase = (void *)PADDR_TO_KVADDR(pas[i]);
+		iov[i].iov_len = PAGE_SIZE;
+	}
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = npages;
+	ku.uio_offset = (off_t)slot * PAGE_SIZE;
+	ku.uio_resid = npages * PAGE_SIZE;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = rw;
+	ku.uio_space = NULL;
+
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &ku);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &ku);
+	}
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+
+	spinlock_acquire(&swap_lock);
+	if (rw == UIO_READ) {
+		swap_nreads += npages;
+		swap_nreadreqs++;
+	}
+	else {
+		swap_nwrites += npages;
+	}
+	spinlock_release(&swap_lock);
+	return 0;
+}
+
+int
+swap_read(unsigned slot, paddr_t pa)
+{
+	return swap_readrun(slot, &pa, 1);
+}
+
+/*
+ * Pages held compressed come from there; the runs of pages between
+ * them are read from the disk.
+ */
+int
+swap_readrun(unsigned slot, const paddr_t *pas, unsigned npages)
+{
+	unsigned i, j;
+	int result;
+
+	i = 0;
+	while (i < npages) {
+		for (j = i; j < npages && !zswap_load(slot + j, pas[j]); j++) {
+			/* nothing */
+		}
+		if (j > i) {
+			result = swap_io(slot + i, &pas[i], j - i, UIO_READ);
+			if (result) {
+				return result;
+			}
+		}
+		i = j + 1;
+	}
+	return 0;
+}
+
+int
+swap_write(unsigned slot, paddr_t pa)
+{
+	if (zswap_store(slot, pa)) {
+		return 0;
+	}
+	return swap_io(slot, &pa, 1, UIO_WRITE);
+}
+
+void
+swap_printstats(void)
+{
+	unsigned nused, nreads, nreadreqs, nwrites, nclustered;
+
+	if (swap_vnode == NULL) {
+		kprintf("swap: disabled\n");
+		return;
+	}
+
+	spinlock_acquire(&swap_lock);
+	nused = swap_nused;
+	nreads = swap_nreads;
+	nreadreqs = swap_nreadreqs;
+	nwrites = swap_nwrites;
+	nclustered = swap_nclustered;
+	spinlock_release(&swap_lock);
+
+	kprintf("swap: %u/%u slots in use\n", nused, swap_nslots);
+	kprintf("    %u pages read in %u requests, %u written\n",
+		nreads, nreadreqs, nwrites);
+	kprintf("    %u slots allocated next to a neighbor\n", nclustered);
+}
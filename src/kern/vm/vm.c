@@ -0,0 +1,731 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Machine-independent VM system: kernel page allocation and user
+ * page fault handling for demand-paged address spaces.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <cpu.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <vmtlb.h>
+#include <swap.h>
+#include <pageout.h>
+#include <pagecache.h>
+
+/*
+ * Wrap ram_stealmem in a spinlock. It is only used for the few
+ * allocations made before the coremap exists.
+ */
+static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * A page of zeros, mapped read-only wherever a page that has never
+ * been written is read. We hold a reference to it forever, so it is
+ * always shared and never freed, and it has no owner, so it is never
+ * paged out. Writing to it breaks copy-on-write as usual.
+ */
+static paddr_t vm_zeropage;
+
+void
+vm_bootstrap(void)
+{
+	coremap_bootstrap();
+
+	vm_zeropage = coremap_alloc_user(NULL, 0);
+	if (vm_zeropage == 0) {
+		panic("vm: no memory for the zero page\n");
+	}
+	bzero((void *)PADDR_TO_KVADDR(vm_zeropage), PAGE_SIZE);
+	coremap_unbusy(vm_zeropage);
+
+	swap_bootstrap();
+	pageout_bootstrap();
+}
+
+/*
+ * Check if we're in a context that can sleep.
+ */
+static
+void
+vm_can_sleep(void)
+{
+	if (CURCPU_EXISTS()) {
+		/* must not hold spinlocks */
+		KASSERT(curcpu->c_spinlocks == 0);
+
+		/* must not be in an interrupt handler */
+		KASSERT(curthread->t_in_interrupt == 0);
+	}
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(unsigned npages)
+{
+	paddr_t pa;
+
+	vm_can_sleep();
+
+	if (coremap_isready()) {
+		pa = coremap_alloc(npages);
+	}
+	else {
+		spinlock_acquire(&stealmem_lock);
+		pa = ram_stealmem(npages);
+		spinlock_release(&stealmem_lock);
+	}
+	if (pa == 0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	/*
+	 * Pages stolen before the coremap was set up are marked fixed
+	 * in it and coremap_free ignores them; before that, there is
+	 * nothing to give them back to.
+	 */
+	if (coremap_isready()) {
+		coremap_free(KVADDR_TO_PADDR(addr));
+	}
+}
+
+/*
+ * Handle a shootdown request from another CPU. Called in interrupt
+ * context.
+ */
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	vmtlb_invalidate(ts->ts_va, ts->ts_npages, ts->ts_pid);
+}
+
+/*
+ * Handle a shootdown request that overflowed the queue: flush
+ * everything. Called in interrupt context.
+ */
+void
+vm_tlbshootdown_all(void)
+{
+	vmtlb_flush();
+}
+
+/*
+ * Work out which part of the page at VA in region RG comes from the
+ * region's backing file: [*LO, *HI). Empty if *LO >= *HI.
+ */
+static
+void
+vm_fileextent(struct region *rg, vaddr_t va, vaddr_t *lo, vaddr_t *hi)
+{
+	*lo = va > rg->rg_fileva ? va : rg->rg_fileva;
+	*hi = va + PAGE_SIZE;
+	if (*hi > rg->rg_fileva + rg->rg_filesize) {
+		*hi = rg->rg_fileva + rg->rg_filesize;
+	}
+}
+
+/*
+ * Map whatever of the aligned cluster of pages around VA in RG is
+ * already in the page cache, so touching those pages later doesn't
+ * fault. Only file pages not yet touched are considered, and nothing
+ * is read. Called with as_lock held.
+ */
+static
+void
+vm_faultaround(struct region *rg, vaddr_t va, pte_t *pte)
+{
+	pte_t *first;
+	vaddr_t base, p, lo, hi;
+	paddr_t pa;
+	unsigned pos, i;
+
+	pos = (va / PAGE_SIZE) % SWAP_CLUSTER;
+	base = va - pos * PAGE_SIZE;
+	first = pte - pos;
+
+	for (i = 0; i < SWAP_CLUSTER; i++) {
+		p = base + i * PAGE_SIZE;
+		if (i == pos || p < rg->rg_base || p >= rg->rg_top ||
+		    first[i] != 0) {
+			continue;
+		}
+		vm_fileextent(rg, p, &lo, &hi);
+		if (lo >= hi) {
+			continue;
+		}
+		if (pagecache_lookup(rg->rg_vnode,
+				     rg->rg_offset + (lo - rg->rg_fileva),
+				     lo - p, hi - lo, &pa)) {
+			first[i] = pa | PTE_RESIDENT | PTE_VALID;
+		}
+	}
+}
+
+/*
+ * Map a page of file data from the page cache, so that everyone
+ * running the same program or mapping the same file shares it. The
+ * page is always mapped read-only; in a writable region the first
+ * write copies it. Called and returns with as_lock held.
+ */
+static
+int
+vm_pagein_shared(struct addrspace *as, struct region *rg, vaddr_t va,
+		 pte_t *pte)
+{
+	pte_t oldpte;
+	vaddr_t lo, hi;
+	paddr_t pa;
+	int result;
+
+	oldpte = *pte;
+	spinlock_release(&as->as_lock);
+
+	/* Pages with no file data get the zero page instead. */
+	vm_fileextent(rg, va, &lo, &hi);
+	KASSERT(lo < hi);
+	result = pagecache_get(rg->rg_vnode,
+			       rg->rg_offset + (lo - rg->rg_fileva),
+			       lo - va, hi - lo, &pa);
+	if (result) {
+		spinlock_acquire(&as->as_lock);
+		return result;
+	}
+
+	spinlock_acquire(&as->as_lock);
+	if (*pte != oldpte) {
+		spinlock_release(&as->as_lock);
+		coremap_free(pa);
+		spinlock_acquire(&as->as_lock);
+		return 0;
+	}
+	*pte = pa | PTE_RESIDENT | PTE_VALID;
+	if (rg->rg_advice != MADV_RANDOM) {
+		vm_faultaround(rg, va, pte);
+	}
+	return 0;
+}
+
+/*
+ * Read the page at VA, which is out on swap, back in. Neighbors in
+ * the same aligned cluster of pages that are in the neighboring
+ * slots come back with it in the same request, so a run of pages
+ * costs one seek instead of one each; pageout tries to put them
+ * there. Neighbors are skipped if memory is short or the region is
+ * MADV_RANDOM. Called and returns with as_lock held.
+ */
+static
+int
+vm_swapin(struct addrspace *as, struct region *rg, vaddr_t va, pte_t *pte,
+	  bool writable)
+{
+	pte_t oldptes[SWAP_CLUSTER], *first;
+	paddr_t pas[SWAP_CLUSTER];
+	unsigned pos, lo, hi, i, slot;
+	vaddr_t base;
+	int result;
+
+	pos = (va / PAGE_SIZE) % SWAP_CLUSTER;
+	base = va - pos * PAGE_SIZE;
+	first = pte - pos;
+	slot = PTE_SLOT(*pte);
+
+	lo = hi = pos;
+	if (rg->rg_advice != MADV_RANDOM && !coremap_pageout_needed()) {
+		while (lo > 0 && base + (lo - 1) * PAGE_SIZE >= rg->rg_base &&
+		       first[lo - 1] == PTE_MKSWAP(slot - pos + lo - 1)) {
+			lo--;
+		}
+		while (hi + 1 < SWAP_CLUSTER &&
+		       base + (hi + 1) * PAGE_SIZE < rg->rg_top &&
+		       first[hi + 1] == PTE_MKSWAP(slot - pos + hi + 1)) {
+			hi++;
+		}
+	}
+	for (i = lo; i <= hi; i++) {
+		oldptes[i] = first[i];
+	}
+	spinlock_release(&as->as_lock);
+
+	/* The page we need first, then as many neighbors as we get. */
+	pas[pos] = coremap_alloc_user(as, va);
+	if (pas[pos] == 0) {
+		spinlock_acquire(&as->as_lock);
+		return ENOMEM;
+	}
+	for (i = pos; i > lo; i--) {
+		pas[i - 1] = coremap_alloc_user(as, base + (i - 1) * PAGE_SIZE);
+		if (pas[i - 1] == 0) {
+			break;
+		}
+	}
+	lo = i;
+	for (i = pos; i < hi; i++) {
+		pas[i + 1] = coremap_alloc_user(as, base + (i + 1) * PAGE_SIZE);
+		if (pas[i + 1] == 0) {
+			break;
+		}
+	}
+	hi = i;
+
+	result = swap_readrun(slot - pos + lo, &pas[lo], hi - lo + 1);
+	if (result) {
+		for (i = lo; i <= hi; i++) {
+			coremap_unbusy(pas[i]);
+			coremap_free(pas[i]);
+		}
+		spinlock_acquire(&as->as_lock);
+		return result;
+	}
+
+	spinlock_acquire(&as->as_lock);
+	for (i = lo; i <= hi; i++) {
+		if (first[i] == oldptes[i]) {
+			first[i] = pas[i] | PTE_RESIDENT | PTE_VALID |
+				(writable ? PTE_DIRTY : 0);
+		}
+		else {
+			/* Changed while we slept; throw ours away. */
+			oldptes[i] = 0;
+		}
+	}
+	spinlock_release(&as->as_lock);
+
+	for (i = lo; i <= hi; i++) {
+		coremap_unbusy(pas[i]);
+		if (oldptes[i] != 0) {
+			swap_free(PTE_SLOT(oldptes[i]));
+		}
+		else {
+			coremap_free(pas[i]);
+		}
+	}
+
+	spinlock_acquire(&as->as_lock);
+	return 0;
+}
+
+/*
+ * Make the non-resident page PTE refers to resident: wait for a
+ * pageout in progress, read it back from swap, map the file data from
+ * the page cache, or zero-fill it. Reads of never-touched pages with
+ * no file data get the zero page. Either way, a private page is only
+ * allocated when one is written. The page may or may not be resident
+ * afterwards; the caller should check again. Called and returns with
+ * as_lock held.
+ */
+static
+int
+vm_pagein(struct addrspace *as, struct region *rg, vaddr_t va, pte_t *pte,
+	  bool writable, bool write)
+{
+	pte_t oldpte;
+	vaddr_t lo, hi;
+	paddr_t pa;
+
+	oldpte = *pte;
+	KASSERT((oldpte & PTE_RESIDENT) == 0);
+
+	if (oldpte == 0) {
+		lo = hi = 0;
+		if (rg->rg_vnode != NULL) {
+			vm_fileextent(rg, va, &lo, &hi);
+		}
+		if (lo < hi) {
+			/* File data: share it. */
+			return vm_pagein_shared(as, rg, va, pte);
+		}
+		if (!write) {
+			/* Nothing but zeros here yet. */
+			coremap_share(vm_zeropage);
+			*pte = vm_zeropage | PTE_RESIDENT | PTE_VALID;
+			return 0;
+		}
+	}
+
+	if (oldpte & PTE_SWAPPED) {
+		return vm_swapin(as, rg, va, pte, writable);
+	}
+
+	spinlock_release(&as->as_lock);
+
+	if (oldpte & PTE_BUSY) {
+		/* Being paged out. Wait until that's done and look again. */
+		coremap_waitbusy(oldpte & PTE_FRAME);
+		spinlock_acquire(&as->as_lock);
+		return 0;
+	}
+
+	/* First write: supply a zero-filled page. */
+	pa = coremap_alloc_user(as, va);
+	if (pa == 0) {
+		spinlock_acquire(&as->as_lock);
+		return ENOMEM;
+	}
+	bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+
+	spinlock_acquire(&as->as_lock);
+	if (*pte != oldpte) {
+		/* Changed while we slept; throw ours away. */
+		spinlock_release(&as->as_lock);
+		coremap_unbusy(pa);
+		coremap_free(pa);
+		spinlock_acquire(&as->as_lock);
+		return 0;
+	}
+	*pte = pa | PTE_RESIDENT | PTE_VALID |
+		(writable ? PTE_DIRTY : 0);
+	spinlock_release(&as->as_lock);
+
+	coremap_unbusy(pa);
+
+	spinlock_acquire(&as->as_lock);
+	return 0;
+}
+
+/*
+ * Give the current address space its own writable copy of the page
+ * PTE refers to, which is resident and shared copy-on-write. Called
+ * and returns with as_lock held.
+ */
+static
+int
+vm_cowbreak(struct addrspace *as, vaddr_t va, pte_t *pte)
+{
+	pte_t oldpte;
+	paddr_t oldpa, pa;
+
+	oldpte = *pte;
+	oldpa = oldpte & PTE_FRAME;
+
+	if (coremap_refcount(oldpa) == 1) {
+		/* Everyone else has let go already; just take it. */
+		coremap_setowner(oldpa, as, va);
+		*pte |= PTE_DIRTY;
+		return 0;
+	}
+
+	/*
+	 * Our reference keeps the old page from going away while the
+	 * lock is dropped for the allocation and copy.
+	 */
+	spinlock_release(&as->as_lock);
+	pa = coremap_alloc_user(as, va);
+	if (pa == 0) {
+		spinlock_acquire(&as->as_lock);
+		return ENOMEM;
+	}
+	if (oldpa == vm_zeropage) {
+		bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+	}
+	else {
+		memmove((void *)PADDR_TO_KVADDR(pa),
+			(const void *)PADDR_TO_KVADDR(oldpa), PAGE_SIZE);
+	}
+	spinlock_acquire(&as->as_lock);
+
+	if (*pte != oldpte) {
+		/* Changed underneath us; use whatever is there now. */
+		spinlock_release(&as->as_lock);
+		coremap_unbusy(pa);
+		coremap_free(pa);
+		spinlock_acquire(&as->as_lock);
+		return 0;
+	}
+	*pte = pa | PTE_RESIDENT | PTE_VALID | PTE_DIRTY |
+		(oldpte & PTE_LOCKED);
+	/* Other CPUs may still map the old page; it's not ours anymore. */
+	vmtlb_unmap(as, va, 1);
+
+	spinlock_release(&as->as_lock);
+	coremap_unbusy(pa);
+	coremap_unmap(oldpa, as, va);
+	spinlock_acquire(&as->as_lock);
+	return 0;
+}
+
+/*
+ * Get the page at VA resident and referenced, and privately writable
+ * if WRITE. The helpers drop the lock while they work, so loop until
+ * the entry is found in a usable state. Called and returns with
+ * as_lock held.
+ */
+static
+int
+vm_resolve(struct addrspace *as, struct region *rg, vaddr_t va, pte_t *pte,
+	   bool writable, bool write)
+{
+	int result;
+
+	while (1) {
+		if ((*pte & PTE_RESIDENT) == 0) {
+			result = vm_pagein(as, rg, va, pte, writable, write);
+		}
+		else if ((*pte & PTE_VALID) == 0) {
+			/*
+			 * Resident, but the pageout daemon cleared the
+			 * reference bit. Set it again.
+			 */
+			*pte |= PTE_VALID;
+			result = 0;
+		}
+		else if (write && (*pte & PTE_DIRTY) == 0) {
+			/* Writable region, read-only page: copy-on-write. */
+			result = vm_cowbreak(as, va, pte);
+		}
+		else {
+			return 0;
+		}
+		if (result) {
+			return result;
+		}
+	}
+}
+
+/*
+ * Bring in the page at VA if it is out on swap or has file data that
+ * isn't mapped yet, without waiting for it to be touched. Failures
+ * are ignored; the page will just fault later.
+ */
+void
+vm_prefetch(struct addrspace *as, struct region *rg, vaddr_t va)
+{
+	pte_t *pte;
+	vaddr_t lo, hi;
+	bool want;
+
+	pte = pt_lookup(as->as_pt, va, true);
+	if (pte == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&as->as_lock);
+	want = false;
+	if (*pte & PTE_SWAPPED) {
+		want = true;
+	}
+	else if (*pte == 0 && rg->rg_vnode != NULL) {
+		vm_fileextent(rg, va, &lo, &hi);
+		want = lo < hi;
+	}
+	if (want) {
+		(void)vm_pagein(as, rg, va, pte,
+				(rg->rg_flags & RG_WRITE) || as->as_loading,
+				false);
+	}
+	spinlock_release(&as->as_lock);
+}
+
+/*
+ * Lock the page at VA into memory: make it resident (and, in a
+ * writable region, our own, so writing it won't need a new page) and
+ * mark it so the pageout daemon leaves it alone. Or, if !LOCK, undo
+ * that. Locked pages are counted in the address space and against
+ * the system-wide limit; past that, locking fails with EAGAIN.
+ */
+int
+vm_lockpage(struct addrspace *as, struct region *rg, vaddr_t va, bool lock)
+{
+	pte_t *pte;
+	bool writable, counted;
+	int result;
+
+	pte = pt_lookup(as->as_pt, va, lock);
+	if (pte == NULL) {
+		return lock ? ENOMEM : 0;
+	}
+
+	spinlock_acquire(&as->as_lock);
+	if (!lock) {
+		counted = (*pte & PTE_LOCKED) != 0;
+		if (counted) {
+			*pte &= ~PTE_LOCKED;
+			KASSERT(as->as_nlocked > 0);
+			as->as_nlocked--;
+		}
+		spinlock_release(&as->as_lock);
+		if (counted) {
+			coremap_unlockpage();
+		}
+		return 0;
+	}
+
+	counted = false;
+	if ((*pte & PTE_LOCKED) == 0) {
+		if (!coremap_lockpage()) {
+			spinlock_release(&as->as_lock);
+			return EAGAIN;
+		}
+		counted = true;
+	}
+	writable = (rg->rg_flags & RG_WRITE) || as->as_loading;
+	result = vm_resolve(as, rg, va, pte, writable, writable);
+	if (result == 0 && counted && (*pte & PTE_LOCKED) == 0) {
+		*pte |= PTE_LOCKED;
+		as->as_nlocked++;
+		counted = false;
+	}
+	spinlock_release(&as->as_lock);
+	if (counted) {
+		/* Failed, or another thread locked it meanwhile. */
+		coremap_unlockpage();
+	}
+	return result;
+}
+
+/*
+ * Pages to read ahead of a fault in a MADV_SEQUENTIAL region, and how
+ * far behind the fault pages are taken to be finished with.
+ */
+#define VM_READAHEAD	8
+#define VM_DROPBEHIND	16
+
+/*
+ * After a fault at VA in a MADV_SEQUENTIAL region, read the next few
+ * pages in, and mark the ones a little way back as not recently used
+ * so they go first when memory is short.
+ */
+static
+void
+vm_sequential(struct addrspace *as, struct region *rg, vaddr_t va)
+{
+	vaddr_t p, stop;
+
+	stop = va + VM_READAHEAD * PAGE_SIZE;
+	if (stop > rg->rg_top || stop < va) {
+		stop = rg->rg_top;
+	}
+	for (p = va + PAGE_SIZE; p < stop; p += PAGE_SIZE) {
+		vm_prefetch(as, rg, p);
+	}
+
+	/*
+	 * Faults only come every VM_READAHEAD or so pages, so cover
+	 * twice that much behind.
+	 */
+	if (va - rg->rg_base <= VM_DROPBEHIND * PAGE_SIZE) {
+		return;
+	}
+	stop = va - VM_DROPBEHIND * PAGE_SIZE;
+	p = stop - rg->rg_base > 2 * VM_READAHEAD * PAGE_SIZE ?
+		stop - 2 * VM_READAHEAD * PAGE_SIZE : rg->rg_base;
+	for (; p < stop; p += PAGE_SIZE) {
+		pageout_deactivate(as, p);
+	}
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct region *rg;
+	pte_t *pte;
+	bool writable;
+	int result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	rg = as_findregion(as, faultaddress);
+	if (rg == NULL) {
+		return EFAULT;
+	}
+	if ((rg->rg_flags & (RG_READ | RG_WRITE | RG_EXEC)) == 0) {
+		/* PROT_NONE */
+		return EFAULT;
+	}
+	writable = (rg->rg_flags & RG_WRITE) || as->as_loading;
+	if (faulttype != VM_FAULT_READ && !writable) {
+		return EFAULT;
+	}
+
+	pte = pt_lookup(as->as_pt, faultaddress, true);
+	if (pte == NULL) {
+		return ENOMEM;
+	}
+
+	spinlock_acquire(&as->as_lock);
+	result = vm_resolve(as, rg, faultaddress, pte, writable,
+			    faulttype != VM_FAULT_READ);
+	if (result) {
+		spinlock_release(&as->as_lock);
+		return result;
+	}
+	vmtlb_load(faultaddress, *pte & PTE_TLBBITS);
+	spinlock_release(&as->as_lock);
+
+	if (rg->rg_advice == MADV_SEQUENTIAL) {
+		vm_sequential(as, rg, faultaddress);
+	}
+
+	return 0;
+}
@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * TLB management for the VM system.
+ *
+ * User translations are tagged with the address space ID (ASID) of
+ * their address space, so switching address spaces doesn't require
+ * flushing the TLB and a process switched back to finds its entries
+ * still there.
+ *
+ * ASIDs are handed out from a global counter; 0 is never handed out.
+ * An address space's ASID is only good for the generation it was
+ * assigned in. When the counter runs out a new generation starts:
+ * every address space gets a new ASID the next time it is activated,
+ * and every CPU flushes its TLB the first time it activates anything
+ * in the new generation. Deferring the flush that way is safe because
+ * a CPU cannot match an old entry before loading a new-generation
+ * ASID, and it flushes before doing that.
+ *
+ * Dropping all of an address space's translations on every CPU is
+ * done by giving it a fresh ASID ("retiring" the old one); entries
+ * tagged with the old ASID can never match again, and no IPIs are
+ * needed.
+ *
+ * The address space's as_asid and as_cpus, and the per-CPU state
+ * below, are protected by vmtlb_lock. as_cpus is the set of CPUs that
+ * may hold entries tagged with as_asid.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <mips/tlb.h>
+#include <platform/maxcpus.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <vmtlb.h>
+
+/* as_asid holds the generation times NUM_ASID plus the ASID. */
+#define ASID_GEN(a)	((a) / NUM_ASID)
+#define ASID_PID(a)	(((a) % NUM_ASID) << TLBHI_PIDSHIFT)
+
+struct vmtlb_cpu {
+	uint32_t vc_gen;		/* generation the TLB is clean for */
+	struct addrspace *vc_as;	/* address space last activated */
+	uint32_t vc_pid;		/* PID field loaded in EntryHi */
+};
+
+static struct spinlock vmtlb_lock = SPINLOCK_INITIALIZER;
+static uint32_t vmtlb_gen = 1;		/* current generation */
+static uint32_t vmtlb_nextasid = 1;	/* next ASID to hand out */
+static struct vmtlb_cpu vmtlb_cpus[MAXCPUS];
+
+/* Statistics */
+static unsigned vmtlb_nactivate;	/* address space switches */
+static unsigned vmtlb_nassign;		/* ASIDs handed out */
+static unsigned vmtlb_nretire;		/* ASIDs retired */
+static unsigned vmtlb_nflush;		/* whole-TLB flushes */
+static unsigned vmtlb_nremote;		/* shootdown requests queued */
+static unsigned vmtlb_nipi;		/* shootdown IPIs sent */
+
+/*
+ * Invalidate every entry in this CPU's TLB.
+ */
+static
+void
+vmtlb_flushlocal(void)
+{
+	int i, spl;
+
+	spl = splhigh();
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+
+	splx(spl);
+}
+
+/*
+ * Give AS a new ASID in the current generation, starting a new
+ * generation if we've run out. vmtlb_lock must be held.
+ */
+static
+void
+vmtlb_assign(struct addrspace *as)
+{
+	if (vmtlb_nextasid == NUM_ASID) {
+		vmtlb_gen++;
+		vmtlb_nextasid = 1;
+	}
+	as->as_asid = vmtlb_gen * NUM_ASID + vmtlb_nextasid;
+	as->as_cpus = 0;
+	vmtlb_nextasid++;
+	vmtlb_nassign++;
+}
+
+/*
+ * Make AS the address space whose translations this CPU uses.
+ * vmtlb_lock must be held.
+ */
+static
+void
+vmtlb_switchto(struct addrspace *as)
+{
+	struct vmtlb_cpu *vc;
+	unsigned cpunum;
+
+	COMPILE_ASSERT(MAXCPUS <= 32);	/* as_cpus is a 32-bit mask */
+
+	cpunum = curcpu->c_number;
+	vc = &vmtlb_cpus[cpunum];
+
+	if (ASID_GEN(as->as_asid) != vmtlb_gen) {
+		vmtlb_assign(as);
+	}
+	if (vc->vc_gen != vmtlb_gen) {
+		/* First use of this generation here; forget the old one. */
+		vmtlb_flushlocal();
+		vc->vc_gen = vmtlb_gen;
+		vmtlb_nflush++;
+	}
+
+	as->as_cpus |= (uint32_t)1 << cpunum;
+	vc->vc_as = as;
+	vc->vc_pid = ASID_PID(as->as_asid);
+	cpupagetables[cpunum] = (vaddr_t)as->as_pt;
+	tlb_setentryhi(vc->vc_pid);
+}
+
+/*
+ * Throw away AS's ASID. If it's the one this CPU is using, get a new
+ * one right away. vmtlb_lock must be held.
+ */
+static
+void
+vmtlb_retire(struct addrspace *as)
+{
+	as->as_asid = 0;
+	as->as_cpus = 0;
+	vmtlb_nretire++;
+	if (vmtlb_cpus[curcpu->c_number].vc_as == as) {
+		vmtlb_switchto(as);
+	}
+}
+
+void
+vmtlb_activate(struct addrspace *as)
+{
+	spinlock_acquire(&vmtlb_lock);
+	vmtlb_switchto(as);
+	vmtlb_nactivate++;
+	spinlock_release(&vmtlb_lock);
+}
+
+void
+vmtlb_deactivate(void)
+{
+	struct vmtlb_cpu *vc;
+
+	spinlock_acquire(&vmtlb_lock);
+	vc = &vmtlb_cpus[curcpu->c_number];
+	vc->vc_as = NULL;
+	vc->vc_pid = 0;
+	cpupagetables[curcpu->c_number] = 0;
+	tlb_setentryhi(0);
+	spinlock_release(&vmtlb_lock);
+}
+
+void
+vmtlb_forget(struct addrspace *as)
+{
+	unsigned i;
+
+	spinlock_acquire(&vmtlb_lock);
+	for (i=0; i<MAXCPUS; i++) {
+		if (vmtlb_cpus[i].vc_as == as) {
+			vmtlb_cpus[i].vc_as = NULL;
+		}
+		if (cpupagetables[i] == (vaddr_t)as->as_pt) {
+			cpupagetables[i] = 0;
+		}
+	}
+	spinlock_release(&vmtlb_lock);
+}
+
+void
+vmtlb_load(vaddr_t va, uint32_t elo)
+{
+	int spl, index;
+	uint32_t ehi;
+
+	KASSERT((va & PAGE_FRAME) == va);
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	ehi = va | vmtlb_cpus[curcpu->c_number].vc_pid;
+
+	/* Never create two entries for the same page. */
+	index = tlb_probe(ehi, 0);
+	if (index >= 0) {
+		tlb_write(ehi, elo, index);
+	}
+	else {
+		tlb_random(ehi, elo);
+	}
+
+	splx(spl);
+}
+
+/*
+ * Above this many pages it's cheaper to look at every TLB entry than
+ * to probe for each page.
+ */
+#define VMTLB_PROBEMAX	(NUM_TLB / 4)
+
+void
+vmtlb_invalidate(vaddr_t va, unsigned npages, uint32_t pid)
+{
+	int spl, index;
+	unsigned i;
+	uint32_t ehi, elo;
+	vaddr_t top;
+
+	KASSERT((va & PAGE_FRAME) == va);
+	KASSERT((pid & TLBHI_PID) == pid);
+
+	spl = splhigh();
+
+	if (npages <= VMTLB_PROBEMAX) {
+		for (i=0; i<npages; i++) {
+			index = tlb_probe((va + i * PAGE_SIZE) | pid, 0);
+			if (index >= 0) {
+				tlb_write(TLBHI_INVALID(index),
+					  TLBLO_INVALID(), index);
+			}
+		}
+	}
+	else {
+		top = va + npages * PAGE_SIZE;
+		for (i=0; i<NUM_TLB; i++) {
+			tlb_read(&ehi, &elo, i);
+			if ((ehi & TLBHI_PID) == pid &&
+			    (ehi & TLBHI_VPAGE) >= va &&
+			    (ehi & TLBHI_VPAGE) < top) {
+				tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+			}
+		}
+	}
+
+	/* Put back the current ASID. */
+	tlb_setentryhi(vmtlb_cpus[curcpu->c_number].vc_pid);
+
+	splx(spl);
+}
+
+void
+vmtlb_flush(void)
+{
+	int spl;
+
+	spl = splhigh();
+	vmtlb_flushlocal();
+	tlb_setentryhi(vmtlb_cpus[curcpu->c_number].vc_pid);
+	splx(spl);
+}
+
+void
+vmtlb_unmap(struct addrspace *as, vaddr_t va, unsigned npages)
+{
+	uint32_t mycpu;
+
+	spinlock_acquire(&vmtlb_lock);
+	mycpu = (uint32_t)1 << curcpu->c_number;
+	if (as->as_cpus & mycpu) {
+		vmtlb_invalidate(va, npages, ASID_PID(as->as_asid));
+	}
+	if (as->as_cpus & ~mycpu) {
+		/* It has run elsewhere too; cheaper than asking. */
+		vmtlb_retire(as);
+	}
+	spinlock_release(&vmtlb_lock);
+}
+
+void
+vmtlb_unmapall(struct addrspace *as)
+{
+	spinlock_acquire(&vmtlb_lock);
+	if (as->as_cpus != 0) {
+		vmtlb_retire(as);
+	}
+	spinlock_release(&vmtlb_lock);
+}
+
+void
+vmtlb_shootdown_init(struct vmtlb_pending *vp)
+{
+	vp->vp_queued = 0;
+	vp->vp_sent = 0;
+}
+
+void
+vmtlb_shootdown_add(struct vmtlb_pending *vp, struct addrspace *as,
+		    vaddr_t va, unsigned npages)
+{
+	struct tlbshootdown ts;
+	struct cpu *c;
+	unsigned i;
+	uint32_t cpus, mycpu;
+
+	spinlock_acquire(&vmtlb_lock);
+	mycpu = (uint32_t)1 << curcpu->c_number;
+	cpus = as->as_cpus;
+	ts.ts_va = va;
+	ts.ts_npages = npages;
+	ts.ts_pid = ASID_PID(as->as_asid);
+	if (cpus & mycpu) {
+		vmtlb_invalidate(va, npages, ts.ts_pid);
+	}
+	spinlock_release(&vmtlb_lock);
+
+	/*
+	 * Only CPUs that have run AS under its current ASID can have
+	 * entries for it. If it gets activated somewhere new after
+	 * this, that CPU will load the already-updated PTEs.
+	 */
+	cpus &= ~mycpu;
+	for (i=0; cpus != 0; i++, cpus >>= 1) {
+		if ((cpus & 1) == 0) {
+			continue;
+		}
+		c = cpu_bynumber(i);
+		KASSERT(c != NULL);
+		ipi_tlbshootdown_queue(c, &ts);
+		vp->vp_queued |= (uint32_t)1 << i;
+		vmtlb_nremote++;
+	}
+}
+
+void
+vmtlb_shootdown_send(struct vmtlb_pending *vp)
+{
+	unsigned i;
+	uint32_t cpus;
+
+	cpus = vp->vp_queued & ~vp->vp_sent;
+	for (i=0; cpus != 0; i++, cpus >>= 1) {
+		if (cpus & 1) {
+			vp->vp_ticket[i] = ipi_tlbshootdown_send(cpu_bynumber(i));
+			vmtlb_nipi++;
+		}
+	}
+	vp->vp_sent = vp->vp_queued;
+}
+
+void
+vmtlb_shootdown_wait(struct vmtlb_pending *vp)
+{
+	unsigned i;
+	uint32_t cpus;
+
+	vmtlb_shootdown_send(vp);
+
+	cpus = vp->vp_sent;
+	for (i=0; cpus != 0; i++, cpus >>= 1) {
+		if (cpus & 1) {
+			ipi_tlbshootdown_wait(cpu_bynumber(i),
+					      vp->vp_ticket[i]);
+		}
+	}
+	vp->vp_queued = 0;
+	vp->vp_sent = 0;
+}
+
+void
+vmtlb_shootdown(struct addrspace *as, vaddr_t va)
+{
+	struct vmtlb_pending vp;
+
+	vmtlb_shootdown_init(&vp);
+	vmtlb_shootdown_add(&vp, as, va, 1);
+	vmtlb_shootdown_wait(&vp);
+}
+
+void
+vmtlb_printstats(void)
+{
+	kprintf("TLB: %u switches, %u ASIDs assigned (%u retired), "
+		"generation %u, %u flushes\n",
+		vmtlb_nactivate, vmtlb_nassign, vmtlb_nretire,
+		vmtlb_gen, vmtlb_nflush);
+	kprintf("TLB: %u remote shootdowns in %u IPIs\n",
+		vmtlb_nremote, vmtlb_nipi);
+}
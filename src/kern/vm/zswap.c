@@ -0,0 +1,505 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Compressed swap cache. See zswap.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <vm.h>
+#include <zswap.h>
+
+/*
+ * Default cap on the pool, in pages. Define ZSWAP_MAXPAGES to change
+ * it at compile time, or use the "zswap" menu command.
+ */
+#ifndef ZSWAP_MAXPAGES
+#define ZSWAP_MAXPAGES 16
+#endif
+
+/* Pages that don't compress to this size or less go to the disk. */
+#define ZSWAP_MAXLEN	(PAGE_SIZE / 2)
+
+/* Compressor parameters. */
+#define ZSWAP_HASHBITS	10
+#define ZSWAP_MINMATCH	4
+
+struct zswap_entry {
+	void *ze_data;			/* compressed page, or NULL */
+	unsigned ze_len;		/* length of ze_data */
+};
+
+static unsigned zswap_nslots;
+
+/* Protects the entries, the byte count, and the counters. */
+static struct spinlock zswap_lock = SPINLOCK_INITIALIZER;
+static struct zswap_entry *zswap_entries;
+static size_t zswap_nbytes;		/* memory used, after rounding */
+static size_t zswap_maxbytes = ZSWAP_MAXPAGES * PAGE_SIZE;
+static unsigned zswap_npages;		/* pages held */
+static size_t zswap_nclen;		/* their total compressed length */
+static unsigned zswap_nstored;
+static unsigned zswap_nrejected;	/* didn't compress well enough */
+static unsigned zswap_nfull;		/* didn't fit */
+static unsigned zswap_nhits;
+static unsigned zswap_nmisses;
+
+/*
+ * Compressor work area. Only one page is compressed at a time;
+ * normally only the pageout daemon writes to swap anyway.
+ */
+static struct semaphore *zswap_worksem;
+static uint16_t zswap_hashtab[1 << ZSWAP_HASHBITS];
+static unsigned char zswap_workbuf[ZSWAP_MAXLEN];
+
+////////////////////////////////////////////////////////////
+// Compressor
+
+/*
+ * The compressed form is a series of sequences, each a token byte,
+ * some literal bytes, and a back-reference:
+ *
+ *    token      - high four bits: literal count; low four bits: match
+ *                 length minus ZSWAP_MINMATCH. 15 in either means
+ *                 more bytes of count follow (after the token for the
+ *                 literal count, after the offset for the match
+ *                 length), each added on, until one isn't 255.
+ *    literals   - copied to the output as is.
+ *    offset     - two bytes, little-endian: how far back the match
+ *                 starts. The match may overlap its own output.
+ *
+ * The last sequence has literals only and ends at the end of the
+ * page; if the page ends with a match, there is no last sequence.
+ */
+
+static
+inline
+uint32_t
+zswap_read32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static
+inline
+unsigned
+zswap_hash(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - ZSWAP_HASHBITS);
+}
+
+/*
+ * Append a count of N for a 4-bit token field (N - 15 of it, if the
+ * field is 15) at *OP. Returns false if it doesn't fit below MAX.
+ */
+static
+bool
+zswap_putcount(unsigned char *dst, size_t *op, size_t max, size_t n)
+{
+	if (n < 15) {
+		return true;
+	}
+	for (n -= 15; n >= 255; n -= 255) {
+		if (*op >= max) {
+			return false;
+		}
+		dst[(*op)++] = 255;
+	}
+	if (*op >= max) {
+		return false;
+	}
+	dst[(*op)++] = n;
+	return true;
+}
+
+/*
+ * Append a sequence: the literals SRC[ANCHOR..END) and, if MLEN isn't
+ * 0, a match of MLEN bytes OFFSET back.
+ */
+static
+bool
+zswap_putseq(unsigned char *dst, size_t *op, size_t max,
+	     const unsigned char *src, size_t anchor, size_t end,
+	     size_t offset, size_t mlen)
+{
+	size_t nlit;
+
+	nlit = end - anchor;
+	if (*op >= max) {
+		return false;
+	}
+	dst[(*op)++] = ((nlit < 15 ? nlit : 15) << 4) |
+		(mlen == 0 ? 0 :
+		 mlen - ZSWAP_MINMATCH < 15 ? mlen - ZSWAP_MINMATCH : 15);
+	if (!zswap_putcount(dst, op, max, nlit)) {
+		return false;
+	}
+	if (nlit > max - *op) {
+		return false;
+	}
+	memcpy(dst + *op, src + anchor, nlit);
+	*op += nlit;
+
+	if (mlen == 0) {
+		return true;
+	}
+	if (max - *op < 2) {
+		return false;
+	}
+	dst[(*op)++] = offset & 0xff;
+	dst[(*op)++] = offset >> 8;
+	return zswap_putcount(dst, op, max, mlen - ZSWAP_MINMATCH);
+}
+
+/*
+ * Compress the page at SRC into DST. Returns the compressed length,
+ * or 0 if it wouldn't fit in MAX bytes.
+ */
+static
+size_t
+zswap_compress(const unsigned char *src, unsigned char *dst, size_t max)
+{
+	size_t ip, anchor, op, cand, mlen;
+	uint32_t v;
+	unsigned h;
+
+	/*
+	 * Stale hash table entries are harmless: candidates are
+	 * checked against the data before they're used.
+	 */
+	ip = anchor = op = 0;
+	while (ip + ZSWAP_MINMATCH <= PAGE_SIZE) {
+		v = zswap_read32(src + ip);
+		h = zswap_hash(v);
+		cand = zswap_hashtab[h];
+		zswap_hashtab[h] = ip;
+		if (cand >= ip || zswap_read32(src + cand) != v) {
+			ip++;
+			continue;
+		}
+
+		mlen = ZSWAP_MINMATCH;
+		while (ip + mlen < PAGE_SIZE &&
+		       src[cand + mlen] == src[ip + mlen]) {
+			mlen++;
+		}
+		if (!zswap_putseq(dst, &op, max, src, anchor, ip,
+				  ip - cand, mlen)) {
+			return 0;
+		}
+		ip += mlen;
+		anchor = ip;
+	}
+
+	if (anchor < PAGE_SIZE &&
+	    !zswap_putseq(dst, &op, max, src, anchor, PAGE_SIZE, 0, 0)) {
+		return 0;
+	}
+	return op;
+}
+
+/*
+ * Read a count continued past its 4-bit token field into *N.
+ */
+static
+int
+zswap_getcount(const unsigned char *src, size_t *ip, size_t len, size_t *n)
+{
+	unsigned char b;
+
+	if (*n < 15) {
+		return 0;
+	}
+	do {
+		if (*ip >= len) {
+			return EIO;
+		}
+		b = src[(*ip)++];
+		*n += b;
+	} while (b == 255);
+	return 0;
+}
+
+/*
+ * Uncompress LEN bytes at SRC into the page at DST. Returns EIO if the
+ * data is malformed.
+ */
+static
+int
+zswap_decompress(const unsigned char *src, size_t len, unsigned char *dst)
+{
+	size_t ip, op, nlit, mlen, offset, i;
+	unsigned char token;
+
+	ip = op = 0;
+	while (1) {
+		if (ip >= len) {
+			return EIO;
+		}
+		token = src[ip++];
+
+		nlit = token >> 4;
+		if (zswap_getcount(src, &ip, len, &nlit)) {
+			return EIO;
+		}
+		if (nlit > len - ip || nlit > PAGE_SIZE - op) {
+			return EIO;
+		}
+		memcpy(dst + op, src + ip, nlit);
+		ip += nlit;
+		op += nlit;
+		if (op == PAGE_SIZE) {
+			break;
+		}
+
+		if (len - ip < 2) {
+			return EIO;
+		}
+		offset = src[ip] | (src[ip + 1] << 8);
+		ip += 2;
+		mlen = token & 0xf;
+		if (zswap_getcount(src, &ip, len, &mlen)) {
+			return EIO;
+		}
+		mlen += ZSWAP_MINMATCH;
+		if (offset == 0 || offset > op || mlen > PAGE_SIZE - op) {
+			return EIO;
+		}
+		/* Byte at a time; the match may overlap what it produces. */
+		for (i = 0; i < mlen; i++) {
+			dst[op + i] = dst[op - offset + i];
+		}
+		op += mlen;
+		if (op == PAGE_SIZE) {
+			break;
+		}
+	}
+	return ip == len ? 0 : EIO;
+}
+
+////////////////////////////////////////////////////////////
+// Pool
+
+/*
+ * Memory a kmalloc of LEN bytes really uses: the next power of two,
+ * at least 16.
+ */
+static
+size_t
+zswap_memsize(size_t len)
+{
+	size_t size;
+
+	for (size = 16; size < len; size *= 2) {
+		/* nothing */
+	}
+	return size;
+}
+
+void
+zswap_bootstrap(unsigned nslots)
+{
+	zswap_nslots = nslots;
+	zswap_entries = kmalloc(nslots * sizeof(zswap_entries[0]));
+	zswap_worksem = sem_create("zswap", 1);
+	if (zswap_entries == NULL || zswap_worksem == NULL) {
+		panic("zswap: Out of memory\n");
+	}
+	bzero(zswap_entries, nslots * sizeof(zswap_entries[0]));
+}
+
+bool
+zswap_store(unsigned slot, paddr_t pa)
+{
+	void *data;
+	size_t len, size;
+
+	KASSERT(slot < zswap_nslots);
+
+	if (zswap_maxbytes == 0) {
+		return false;
+	}
+
+	P(zswap_worksem);
+	len = zswap_compress((const unsigned char *)PADDR_TO_KVADDR(pa),
+			     zswap_workbuf, ZSWAP_MAXLEN);
+	if (len == 0) {
+		V(zswap_worksem);
+		spinlock_acquire(&zswap_lock);
+		zswap_nrejected++;
+		spinlock_release(&zswap_lock);
+		return false;
+	}
+
+	/* Reserve the space, then get it. */
+	size = zswap_memsize(len);
+	spinlock_acquire(&zswap_lock);
+	if (size > zswap_maxbytes || zswap_nbytes > zswap_maxbytes - size) {
+		zswap_nfull++;
+		spinlock_release(&zswap_lock);
+		V(zswap_worksem);
+		return false;
+	}
+	zswap_nbytes += size;
+	spinlock_release(&zswap_lock);
+
+	data = kmalloc(len);
+	if (data != NULL) {
+		memcpy(data, zswap_workbuf, len);
+	}
+	V(zswap_worksem);
+
+	spinlock_acquire(&zswap_lock);
+	if (data == NULL) {
+		zswap_nbytes -= size;
+		zswap_nfull++;
+		spinlock_release(&zswap_lock);
+		return false;
+	}
+	KASSERT(zswap_entries[slot].ze_data == NULL);
+	zswap_entries[slot].ze_data = data;
+	zswap_entries[slot].ze_len = len;
+	zswap_npages++;
+	zswap_nclen += len;
+	zswap_nstored++;
+	spinlock_release(&zswap_lock);
+	return true;
+}
+
+bool
+zswap_load(unsigned slot, paddr_t pa)
+{
+	void *data;
+	size_t len;
+
+	KASSERT(slot < zswap_nslots);
+
+	/*
+	 * The entry can't go away while we use it: the caller holds a
+	 * reference to the slot.
+	 */
+	spinlock_acquire(&zswap_lock);
+	data = zswap_entries[slot].ze_data;
+	len = zswap_entries[slot].ze_len;
+	if (data == NULL) {
+		zswap_nmisses++;
+	}
+	else {
+		zswap_nhits++;
+	}
+	spinlock_release(&zswap_lock);
+
+	if (data == NULL) {
+		return false;
+	}
+	if (zswap_decompress(data, len, (unsigned char *)PADDR_TO_KVADDR(pa))) {
+		panic("zswap: slot %u: bad compressed data\n", slot);
+	}
+	return true;
+}
+
+void
+zswap_drop(unsigned slot)
+{
+	void *data;
+	size_t len;
+
+	KASSERT(slot < zswap_nslots);
+
+	spinlock_acquire(&zswap_lock);
+	data = zswap_entries[slot].ze_data;
+	len = zswap_entries[slot].ze_len;
+	if (data != NULL) {
+		zswap_entries[slot].ze_data = NULL;
+		zswap_entries[slot].ze_len = 0;
+		zswap_nbytes -= zswap_memsize(len);
+		zswap_npages--;
+		zswap_nclen -= len;
+	}
+	spinlock_release(&zswap_lock);
+
+	if (data != NULL) {
+		kfree(data);
+	}
+}
+
+/*
+ * Pages already in the pool stay there if the cap is lowered; they
+ * leave as their slots are freed.
+ */
+void
+zswap_setmax(unsigned npages)
+{
+	spinlock_acquire(&zswap_lock);
+	zswap_maxbytes = (size_t)npages * PAGE_SIZE;
+	spinlock_release(&zswap_lock);
+}
+
+void
+zswap_printstats(void)
+{
+	unsigned npages, nstored, nrejected, nfull, nhits, nmisses;
+	size_t nbytes, maxbytes, nclen;
+	unsigned ratio, hitrate;
+
+	spinlock_acquire(&zswap_lock);
+	nbytes = zswap_nbytes;
+	maxbytes = zswap_maxbytes;
+	npages = zswap_npages;
+	nclen = zswap_nclen;
+	nstored = zswap_nstored;
+	nrejected = zswap_nrejected;
+	nfull = zswap_nfull;
+	nhits = zswap_nhits;
+	nmisses = zswap_nmisses;
+	spinlock_release(&zswap_lock);
+
+	/* Both in hundredths. */
+	ratio = nclen == 0 ? 0 :
+		(unsigned)((uint64_t)npages * PAGE_SIZE * 100 / nclen);
+	hitrate = nhits + nmisses == 0 ? 0 :
+		(unsigned)((uint64_t)nhits * 10000 / (nhits + nmisses));
+
+	kprintf("zswap: %u pages in %u/%u bytes", npages,
+		(unsigned)nbytes, (unsigned)maxbytes);
+	if (maxbytes == 0) {
+		kprintf(" (off)");
+	}
+	kprintf("\n");
+	kprintf("    compression ratio %u.%02u:1\n", ratio / 100, ratio % 100);
+	kprintf("    %u stored, %u incompressible, %u didn't fit\n",
+		nstored, nrejected, nfull);
+	kprintf("    %u hits, %u misses (%u.%02u%% hit rate)\n",
+		nhits, nmisses, hitrate / 100, hitrate % 100);
+}